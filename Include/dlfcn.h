@@ -1,16 +1,53 @@
 #ifndef _CTRDL_DLFCN_H
 #define _CTRDL_DLFCN_H
 
+#if defined(__3DS__)
 #include <3ds.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host builds, matches the libctru types.
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+#endif
+
 #include <sys/types.h>
 #include <stdio.h>
 
 #define RTLD_LOCAL 0x0000
+#define RTLD_LAZY 0x0001
 #define RTLD_NOW 0x0002
 #define RTLD_NOLOAD 0x0004
 #define RTLD_GLOBAL 0x0100
 
+// GNU hash of a symbol name, as taken by ctrdlSymHashed.
+// Only accepts string literals, pointers and arrays don't compile since the length comes from sizeof.
+// Folds to a constant for names of up to 64 characters, longer ones give 0 (hashed at runtime).
+#define CTRDL_SYM_HASH_STEP(s, i, h) \
+    ((h) * (((i) < (sizeof(s) - 1)) ? 33u : 1u) + (((i) < (sizeof(s) - 1)) ? (u8)(s)[((i) < sizeof(s)) ? (i) : 0] : 0u))
+#define CTRDL_SYM_HASH_STEP4(s, i, h) \
+    CTRDL_SYM_HASH_STEP(s, (i) + 3, CTRDL_SYM_HASH_STEP(s, (i) + 2, CTRDL_SYM_HASH_STEP(s, (i) + 1, CTRDL_SYM_HASH_STEP(s, i, h))))
+#define CTRDL_SYM_HASH_STEP16(s, i, h) \
+    CTRDL_SYM_HASH_STEP4(s, (i) + 12, CTRDL_SYM_HASH_STEP4(s, (i) + 8, CTRDL_SYM_HASH_STEP4(s, (i) + 4, CTRDL_SYM_HASH_STEP4(s, i, h))))
+#define CTRDL_SYM_HASH_STEP64(s, h) \
+    CTRDL_SYM_HASH_STEP16(s, 48, CTRDL_SYM_HASH_STEP16(s, 32, CTRDL_SYM_HASH_STEP16(s, 16, CTRDL_SYM_HASH_STEP16(s, 0, h))))
+#define CTRDL_SYM_HASH_LITERAL(s) (((sizeof(s) - 1) > 64) ? 0u : (u32)CTRDL_SYM_HASH_STEP64(s, 5381u))
+#define CTRDL_SYM_HASH(s) CTRDL_SYM_HASH_LITERAL("" s "")
+
+#if defined(__cplusplus)
+constexpr u32 ctrdlSymHash(const char* s, u32 h = 5381) { return *s ? ctrdlSymHash(s + 1, (h * 33u) + (u8)*s) : h; }
+#endif
+
 typedef void*(*CTRDLResolverFn)(const char* sym, void* userData);
+// Called once per object with its undefined symbols, entries left NULL go through the usual lookup.
+typedef void(*CTRDLBatchResolverFn)(const char* const* syms, void** addrs, size_t count, void* userData);
 typedef void(*CTRDLEnumerateFn)(void* handle);
 
 typedef struct {
@@ -21,12 +58,35 @@ typedef struct {
 } Dl_info;
 
 typedef struct {
-    char* path;      // Path.
-    size_t pathSize; // Path size.
-    u32 base;        // Base address.
-    size_t size;     // Size.
+    char* path;            // Path.
+    size_t pathSize;       // Path size.
+    u32 base;              // Base address.
+    size_t size;           // Size.
+    size_t savedSize;      // Bytes saved over padding each segment to its alignment.
+    size_t numPieces;      // Separate allocations backing the image, 1 if contiguous.
+    size_t bytesRead;      // Bytes read from the stream while loading.
+    size_t numReads;       // Number of stream reads while loading.
+    size_t numSeeks;       // Number of stream seeks while loading.
+    size_t symCacheHits;   // Relocation symbols served by the load cache.
+    size_t symCacheMisses; // Relocation symbols resolved while loading.
+    size_t numLazySlots;   // PLT slots left for lazy binding.
+    size_t numBoundSlots;  // Lazy PLT slots bound so far.
 } CTRDLInfo;
 
+typedef struct {
+    size_t totalSize;     // Size of the mirror space.
+    size_t freeSize;      // Free bytes, as tracked by the loader.
+    size_t largestFree;   // Largest free range.
+    size_t numFreeRanges; // Number of free ranges.
+    size_t numStale;      // Placements which found the range used by something else.
+    size_t numFallbacks;  // Placements which had to walk the kernel regions.
+} CTRDLSpaceStats;
+
+typedef struct {
+    size_t hits;   // dlsym calls served by the cache.
+    size_t misses; // dlsym calls which had to look up the symbol.
+} CTRDLSymCacheStats;
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -40,9 +100,22 @@ const char* dlerror(void);
 void* ctrdlOpen(const char* path, int flags, CTRDLResolverFn resolver, void* resolverUserData);
 void* ctrdlFOpen(FILE* f, int flags, CTRDLResolverFn resolver, void* resolverUserData);
 void* ctrdlMap(const void* buffer, size_t size, int flags, CTRDLResolverFn resolver, void* resolverUserData);
+// Maps a page aligned buffer holding the object laid out as in memory, without copying it.
+// The buffer must cover every segment including its BSS, and stay valid until the object is unloaded.
+// The buffer is written to: it is relocated in place, then the BSS and any relocation tables it overlaps are zeroed.
+// On the host backend the buffer must be a MAP_SHARED mapping, it is aliased with mremap and an old size of 0.
+void* ctrdlMapInPlace(void* buffer, size_t size, int flags, CTRDLResolverFn resolver, void* resolverUserData);
+void* ctrdlOpenBatch(const char* path, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData);
+void* ctrdlFOpenBatch(FILE* f, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData);
+void* ctrdlMapBatch(const void* buffer, size_t size, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData);
+void* ctrdlSymHashed(void* handle, const char* name, u32 hash);
+size_t ctrdlSymBatch(void* handle, const char* const* names, size_t n, void** out);
 void* ctrdlHandleByAddress(u32 addr);
 void* ctrdlThisHandle(void);
 void ctrdlEnumerate(CTRDLEnumerateFn callback);
+size_t ctrdlSymbolizeBatch(const u32* addrs, size_t n, Dl_info* out);
+void ctrdlSymCacheStats(CTRDLSymCacheStats* stats);
+bool ctrdlSpaceStats(CTRDLSpaceStats* stats);
 bool ctrdlInfo(void* handle, CTRDLInfo* info);
 void ctrdlFreeInfo(CTRDLInfo* info);
 
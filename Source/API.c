@@ -1,5 +1,7 @@
 #include "Handle.h"
+#include "AddrSpace.h"
 #include "Error.h"
+#include "GlobalSymbols.h"
 #include "Loader.h"
 #include "Symbol.h"
 
@@ -7,17 +9,51 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define RTLD_LAZY 0x0001
 #define RTLD_DEEPBIND 0x0008
 #define RTLD_NODELETE 0x1000
 
+// Entries of the per-thread dlsym cache, must be a power of two up to 0x10000.
+#ifndef CTRDL_SYM_CACHE_SIZE
+#define CTRDL_SYM_CACHE_SIZE 64
+#endif
+
+typedef struct {
+    const CTRDLHandle* handle; // Handle used for the lookup.
+    u32 generation;            // Handle generation at the time of the lookup.
+    const char* name;          // Name pointer used for the lookup.
+    const char* symName;       // Symbol name (mapped), checked on hits.
+    void* addr;                // Symbol address.
+} SymCacheEntry;
+
+// Direct-mapped on the handle and name pointers.
+static __thread SymCacheEntry g_SymCache[CTRDL_SYM_CACHE_SIZE] = {};
+static __thread size_t g_SymCacheHits = 0;
+static __thread size_t g_SymCacheMisses = 0;
+
+typedef struct {
+    u32 addr;
+    size_t index;
+} BatchAddr;
+
+static int ctrdl_compareBatchAddrs(const void* a, const void* b) {
+    const BatchAddr* x = a;
+    const BatchAddr* y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int ctrdl_compareHandleBases(const void* a, const void* b) {
+    const CTRDLHandle* x = *(const CTRDLHandle* const*)a;
+    const CTRDLHandle* y = *(const CTRDLHandle* const*)b;
+    return (x->base > y->base) - (x->base < y->base);
+}
+
 static bool ctrdl_checkFlags(int flags) {
     // Unsupported flags.
-    if (flags & (RTLD_LAZY | RTLD_DEEPBIND | RTLD_NODELETE))
+    if (flags & (RTLD_DEEPBIND | RTLD_NODELETE))
         return false;
 
     // Required flags.
-    if (!(flags & RTLD_NOW))
+    if (!(flags & (RTLD_NOW | RTLD_LAZY)))
         return false;
 
     return true;
@@ -34,10 +70,28 @@ void* dlsym(void* handle, const char* name) {
         return NULL;
     }
 
+    // The generation changes when the handle is reused, and a name buffer might be reused too.
     CTRDLHandle* h = (CTRDLHandle*)handle;
-    const Elf32_Sym* sym = ctrdl_extendedFindSymbolFromName(h, name);
-    if (sym)
-        return (void*)(h->base + sym->st_value);
+    const u32 key = (u32)h ^ (u32)name;
+    const size_t slot = ((key * 0x9E3779B1u) >> 16) & (CTRDL_SYM_CACHE_SIZE - 1);
+    SymCacheEntry* entry = &g_SymCache[slot];
+    if ((entry->handle == h) && (entry->generation == h->generation) && (entry->name == name) && !strcmp(entry->symName, name)) {
+        ++g_SymCacheHits;
+        return entry->addr;
+    }
+
+    ++g_SymCacheMisses;
+
+    CTRDLHandle* owner = NULL;
+    const Elf32_Sym* sym = ctrdl_extendedFindSymbolFromName(h, name, &owner);
+    if (sym) {
+        entry->handle = h;
+        entry->generation = h->generation;
+        entry->name = name;
+        entry->symName = &owner->stringTable[sym->st_name];
+        entry->addr = (void*)(owner->base + sym->st_value);
+        return entry->addr;
+    }
 
     ctrdl_setLastError(Err_NotFound);
     return NULL;
@@ -47,6 +101,7 @@ int dladdr(const void* address, Dl_info* info) {
     if (!info)
         return 0;
 
+    memset(info, 0, sizeof(Dl_info));
     const u32 addr = (u32)address;
     CTRDLHandle* h = ctrdlHandleByAddress(addr);
     if (h) {
@@ -68,7 +123,78 @@ int dladdr(const void* address, Dl_info* info) {
     return info->dli_fbase != NULL;
 }
 
-void* ctrdlOpen(const char* path, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+void* ctrdlSymHashed(void* handle, const char* name, u32 hash) {
+    if (!handle || !name) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return NULL;
+    }
+
+    // Names too long for CTRDL_SYM_HASH.
+    if (!hash)
+        hash = ctrdl_getELFGNUSymNameHash(name);
+
+    CTRDLHandle* owner = NULL;
+    const Elf32_Sym* sym = ctrdl_hashedFindSymbolFromName((CTRDLHandle*)handle, name, hash, &owner);
+    if (sym)
+        return (void*)(owner->base + sym->st_value);
+
+    ctrdl_setLastError(Err_NotFound);
+    return NULL;
+}
+
+size_t ctrdlSymBatch(void* handle, const char* const* names, size_t n, void** out) {
+    if (!handle || ((!names || !out) && n)) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return 0;
+    }
+
+    if (!n)
+        return 0;
+
+    CTRDLHandle* h = (CTRDLHandle*)handle;
+    Elf32_Word* hashes = malloc(n * 2 * sizeof(Elf32_Word));
+    if (!hashes) {
+        ctrdl_setLastError(Err_NoMemory);
+        return 0;
+    }
+
+    // Hash each name once, GNU hashes first then SysV ones.
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = NULL;
+        if (names[i]) {
+            hashes[i] = ctrdl_getELFGNUSymNameHash(names[i]);
+            hashes[n + i] = h->scopeNeedsSysVHash ? ctrdl_getELFSymNameHash(names[i]) : 0;
+        }
+    }
+
+    // Walk the scope once, looking up the names which are still missing in each object.
+    size_t found = 0;
+    ctrdl_lockHandle(h);
+
+    for (size_t i = 0; (i < h->scopeSize) && (found < n); ++i) {
+        CTRDLHandle* dep = h->scope[i];
+        for (size_t j = 0; j < n; ++j) {
+            if (out[j] || !names[j])
+                continue;
+
+            const Elf32_Sym* sym = ctrdl_findSymbolHashed(dep, names[j], hashes[j], hashes[n + j]);
+            if (sym) {
+                out[j] = (void*)(dep->base + sym->st_value);
+                ++found;
+            }
+        }
+    }
+
+    ctrdl_unlockHandle(h);
+    free(hashes);
+
+    if (found < n)
+        ctrdl_setLastError(Err_NotFound);
+
+    return found;
+}
+
+static void* ctrdl_openPath(const char* path, int flags, const CTRDLResolver* resolver) {
     // We don't support the NULL pseudo handle.
     if (!path || !ctrdl_checkFlags(flags)) {
         ctrdl_setLastError(Err_InvalidParam);
@@ -78,12 +204,21 @@ void* ctrdlOpen(const char* path, int flags, CTRDLResolverFn resolver, void* res
     // Avoid reading if already open.
     ctrdl_acquireHandleMtx();
     CTRDLHandle* handle = ctrdl_unsafeFindHandleByName(path);
-    ctrdl_lockHandle(handle);
+    if (handle && !ctrdl_tryLockHandle(handle))
+        handle = NULL;
     ctrdl_releaseHandleMtx();
 
     if (handle) {
-        // Update flags.
-        handle->flags = flags;
+        // Update flags, once global an object stays global.
+        const bool wasGlobal = handle->flags & RTLD_GLOBAL;
+        handle->flags = flags | (handle->flags & RTLD_GLOBAL);
+
+        if (!wasGlobal && (flags & RTLD_GLOBAL) && !ctrdl_addGlobalSymbols(handle)) {
+            handle->flags &= ~RTLD_GLOBAL;
+            ctrdl_unlockHandle(handle);
+            return NULL;
+        }
+
         return (void*)handle;
     }
 
@@ -101,13 +236,13 @@ void* ctrdlOpen(const char* path, int flags, CTRDLResolverFn resolver, void* res
 
     CTRDLStream stream;
     ctrdl_makeFileStream(&stream, f);
-    handle = ctrdl_loadObject(path, flags, &stream, resolver, resolverUserData);
+    handle = ctrdl_loadObject(path, flags, &stream, resolver, NULL);
 
     fclose(f);
     return handle;
 }
 
-void* ctrdlFOpen(FILE* f, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+static void* ctrdl_openFile(FILE* f, int flags, const CTRDLResolver* resolver) {
     if (!f || !ctrdl_checkFlags(flags)) {
         ctrdl_setLastError(Err_InvalidParam);
         return NULL;
@@ -115,10 +250,10 @@ void* ctrdlFOpen(FILE* f, int flags, CTRDLResolverFn resolver, void* resolverUse
 
     CTRDLStream stream;
     ctrdl_makeFileStream(&stream, f);
-    return ctrdl_loadObject(NULL, flags, &stream, resolver, resolverUserData);
+    return ctrdl_loadObject(NULL, flags, &stream, resolver, NULL);
 }
 
-void* ctrdlMap(const void* buffer, size_t size, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+static void* ctrdl_map(const void* buffer, size_t size, int flags, const CTRDLResolver* resolver, void* image) {
     if (!buffer || !size || !ctrdl_checkFlags(flags)) {
         ctrdl_setLastError(Err_InvalidParam);
         return NULL;
@@ -126,18 +261,59 @@ void* ctrdlMap(const void* buffer, size_t size, int flags, CTRDLResolverFn resol
 
     CTRDLStream stream;
     ctrdl_makeMemStream(&stream, buffer, size);
-    return ctrdl_loadObject(NULL, flags, &stream, resolver, resolverUserData);
+    return ctrdl_loadObject(NULL, flags, &stream, resolver, image);
+}
+
+void* ctrdlOpen(const char* path, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { resolver, NULL, resolverUserData };
+    return ctrdl_openPath(path, flags, &r);
+}
+
+void* ctrdlFOpen(FILE* f, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { resolver, NULL, resolverUserData };
+    return ctrdl_openFile(f, flags, &r);
+}
+
+void* ctrdlMap(const void* buffer, size_t size, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { resolver, NULL, resolverUserData };
+    return ctrdl_map(buffer, size, flags, &r, NULL);
+}
+
+void* ctrdlMapInPlace(void* buffer, size_t size, int flags, CTRDLResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { resolver, NULL, resolverUserData };
+    return ctrdl_map(buffer, size, flags, &r, buffer);
+}
+
+void* ctrdlOpenBatch(const char* path, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { NULL, resolver, resolverUserData };
+    return ctrdl_openPath(path, flags, &r);
+}
+
+void* ctrdlFOpenBatch(FILE* f, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { NULL, resolver, resolverUserData };
+    return ctrdl_openFile(f, flags, &r);
+}
+
+void* ctrdlMapBatch(const void* buffer, size_t size, int flags, CTRDLBatchResolverFn resolver, void* resolverUserData) {
+    const CTRDLResolver r = { NULL, resolver, resolverUserData };
+    return ctrdl_map(buffer, size, flags, &r, NULL);
 }
 
 void* ctrdlHandleByAddress(u32 addr) {
-    ctrdl_acquireHandleMtx();
-    CTRDLHandle* handle = ctrdl_unsafeFindHandleByAddr(addr);
-    if (handle) {
-        ctrdl_lockHandle(handle);
+    CTRDLHandle* handle = ctrdl_findHandleByAddr(addr);
+    if (handle && ctrdl_tryLockHandle(handle)) {
+        // The handle might have been reused since the lookup.
+        if ((addr < handle->base) || (addr >= (handle->base + handle->size))) {
+            ctrdl_unlockHandle(handle);
+            handle = NULL;
+        }
     } else {
-        ctrdl_setLastError(Err_NotFound);
+        handle = NULL;
     }
-    ctrdl_releaseHandleMtx();
+
+    if (!handle)
+        ctrdl_setLastError(Err_NotFound);
+
     return handle;
 }
 
@@ -149,15 +325,137 @@ void ctrdlEnumerate(CTRDLEnumerateFn callback) {
         return;
     }
 
+    // The callback might close handles, including ones after it in the list, walk a referenced snapshot.
+    ctrdl_acquireHandleMtx();
+
+    size_t numHandles = 0;
+    for (CTRDLHandle* h = ctrdl_unsafeGetFirstHandle(); h; h = h->next)
+        ++numHandles;
+
+    CTRDLHandle** handles = malloc((numHandles ? numHandles : 1) * sizeof(CTRDLHandle*));
+    if (!handles) {
+        ctrdl_setLastError(Err_NoMemory);
+        ctrdl_releaseHandleMtx();
+        return;
+    }
+
+    size_t count = 0;
+    for (CTRDLHandle* h = ctrdl_unsafeGetFirstHandle(); h; h = h->next) {
+        if (ctrdl_tryLockHandle(h))
+            handles[count++] = h;
+    }
+
+    ctrdl_releaseHandleMtx();
+
+    for (size_t i = 0; i < count; ++i)
+        callback(handles[i]);
+
+    for (size_t i = 0; i < count; ++i)
+        ctrdl_unlockHandle(handles[i]);
+
+    free(handles);
+}
+
+size_t ctrdlSymbolizeBatch(const u32* addrs, size_t n, Dl_info* out) {
+    if (!addrs || !out) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return 0;
+    }
+
+    memset(out, 0, n * sizeof(Dl_info));
+    if (!n)
+        return 0;
+
+    BatchAddr* sorted = malloc(n * sizeof(BatchAddr));
+    if (!sorted) {
+        ctrdl_setLastError(Err_NoMemory);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i].addr = addrs[i];
+        sorted[i].index = i;
+    }
+
+    qsort(sorted, n, sizeof(BatchAddr), ctrdl_compareBatchAddrs);
+
+    size_t found = 0;
     ctrdl_acquireHandleMtx();
 
-    for (size_t i = 0; i < CTRDL_MAX_HANDLES; ++i) {
-        CTRDLHandle* h = ctrdl_unsafeGetHandleByIndex(i);
-        if (h->refc)
-            callback(h);
+    size_t numHandles = 0;
+    for (CTRDLHandle* h = ctrdl_unsafeGetFirstHandle(); h; h = h->next)
+        ++numHandles;
+
+    CTRDLHandle** handles = malloc((numHandles ? numHandles : 1) * sizeof(CTRDLHandle*));
+    if (!handles) {
+        ctrdl_setLastError(Err_NoMemory);
+        ctrdl_releaseHandleMtx();
+        free(sorted);
+        return 0;
+    }
+
+    numHandles = 0;
+    for (CTRDLHandle* h = ctrdl_unsafeGetFirstHandle(); h; h = h->next) {
+        if (h->refc && h->size && h->symEntries)
+            handles[numHandles++] = h;
+    }
+
+    qsort(handles, numHandles, sizeof(CTRDLHandle*), ctrdl_compareHandleBases);
+
+    // Walk addresses, objects and symbols together.
+    size_t handleIndex = 0;
+    size_t symCursor = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const u32 addr = sorted[i].addr;
+        while ((handleIndex < numHandles) && (addr >= (handles[handleIndex]->base + handles[handleIndex]->size))) {
+            ++handleIndex;
+            symCursor = 0;
+        }
+
+        if (handleIndex >= numHandles)
+            break;
+
+        CTRDLHandle* h = handles[handleIndex];
+        if (addr < h->base)
+            continue;
+
+        Dl_info* info = &out[sorted[i].index];
+        info->dli_fname = h->path;
+        info->dli_fbase = (void*)h->base;
+
+        const Elf32_Sym* sym = ctrdl_findSymbolFromValueWithCursor(h, addr - h->base, &symCursor);
+        if (sym) {
+            info->dli_sname = &h->stringTable[sym->st_name];
+            info->dli_saddr = (void*)(h->base + sym->st_value);
+        }
+
+        ++found;
     }
 
     ctrdl_releaseHandleMtx();
+    free(handles);
+    free(sorted);
+    return found;
+}
+
+void ctrdlSymCacheStats(CTRDLSymCacheStats* stats) {
+    if (!stats) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return;
+    }
+
+    stats->hits = g_SymCacheHits;
+    stats->misses = g_SymCacheMisses;
+}
+
+bool ctrdlSpaceStats(CTRDLSpaceStats* stats) {
+    if (!stats) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return false;
+    }
+
+    ctrdl_getAddrSpaceStats(stats);
+    return true;
 }
 
 bool ctrdlInfo(void* handle, CTRDLInfo* info) {
@@ -187,6 +485,15 @@ bool ctrdlInfo(void* handle, CTRDLInfo* info) {
 
     info->base = h->base;
     info->size = h->size;
+    info->savedSize = h->savedSize;
+    info->numPieces = h->pieces ? h->numPieces : 1;
+    info->bytesRead = h->readStats.bytesRead;
+    info->numReads = h->readStats.numReads;
+    info->numSeeks = h->readStats.numSeeks;
+    info->symCacheHits = h->symCacheHits;
+    info->symCacheMisses = h->symCacheMisses;
+    info->numLazySlots = h->numLazySlots;
+    info->numBoundSlots = h->numBoundSlots;
 
     ctrdl_unlockHandle(h);
     return success;
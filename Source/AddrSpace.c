@@ -0,0 +1,237 @@
+#include "AddrSpace.h"
+#include "Error.h"
+#include "Handle.h"
+#include "Platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_FREE_CAPACITY 16
+
+typedef struct {
+    u32 base;    // Range base address.
+    size_t size; // Range size.
+} FreeRange;
+
+// Free ranges sorted by address, guarded by the handle mutex.
+static FreeRange* g_Free = NULL;
+static size_t g_NumFree = 0;
+static size_t g_FreeCapacity = 0;
+static u32 g_SpaceBase = 0;
+static size_t g_SpaceSize = 0;
+static size_t g_NumStale = 0;
+static size_t g_NumFallbacks = 0;
+
+static bool ctrdl_insertFreeRange(size_t index, u32 base, size_t size) {
+    if (g_NumFree >= g_FreeCapacity) {
+        const size_t capacity = g_FreeCapacity ? (g_FreeCapacity * 2) : MIN_FREE_CAPACITY;
+        FreeRange* ranges = realloc(g_Free, capacity * sizeof(FreeRange));
+        if (!ranges)
+            return false;
+
+        g_Free = ranges;
+        g_FreeCapacity = capacity;
+    }
+
+    memmove(&g_Free[index + 1], &g_Free[index], (g_NumFree - index) * sizeof(FreeRange));
+    g_Free[index].base = base;
+    g_Free[index].size = size;
+    ++g_NumFree;
+    return true;
+}
+
+static void ctrdl_eraseFreeRange(size_t index) {
+    memmove(&g_Free[index], &g_Free[index + 1], (g_NumFree - index - 1) * sizeof(FreeRange));
+    --g_NumFree;
+}
+
+static bool ctrdl_initAddrSpace(void) {
+    if (g_SpaceSize)
+        return true;
+
+    if (!ctrdl_getMirrorSpace(&g_SpaceBase, &g_SpaceSize)) {
+        g_SpaceSize = 0;
+        return false;
+    }
+
+    // Everything is assumed free, used regions are found out when placing objects.
+    if (!ctrdl_insertFreeRange(0, g_SpaceBase, g_SpaceSize)) {
+        g_SpaceSize = 0;
+        return false;
+    }
+
+    return true;
+}
+
+// Removes [base, base + size) from the free ranges, returns whether anything was removed.
+// Without memory to split a range its tail is lost, the fallback can still find it.
+static bool ctrdl_carveAddrSpace(u32 base, size_t size) {
+    const u32 end = base + size;
+    bool carved = false;
+
+    for (size_t i = 0; i < g_NumFree; ++i) {
+        FreeRange* r = &g_Free[i];
+        const u32 rangeEnd = r->base + r->size;
+        if ((rangeEnd <= base) || (r->base >= end))
+            continue;
+
+        carved = true;
+        if ((r->base < base) && (rangeEnd > end)) {
+            // Split in two.
+            r->size = base - r->base;
+            ctrdl_insertFreeRange(i + 1, end, rangeEnd - end);
+            break;
+        }
+
+        if (r->base < base) {
+            r->size = base - r->base;
+        } else if (rangeEnd > end) {
+            r->size = rangeEnd - end;
+            r->base = end;
+        } else {
+            ctrdl_eraseFreeRange(i);
+            --i;
+        }
+    }
+
+    return carved;
+}
+
+// Fallback, walks the kernel regions from the start of the space.
+static bool ctrdl_queryAddrSpace(size_t size, u32* out) {
+    CTRDLRegion region;
+    region.base = g_SpaceBase;
+    region.size = 0;
+
+    while (true) {
+        if (!ctrdl_queryRegion(region.base + region.size, &region)) {
+            ctrdl_setLastError(Err_MapFailed);
+            return false;
+        }
+
+        if (region.base >= (g_SpaceBase + g_SpaceSize)) {
+            ctrdl_setLastError(Err_NoMemory);
+            return false;
+        }
+
+        if (region.free && (region.size >= size)) {
+            *out = region.base;
+            return true;
+        }
+    }
+}
+
+static bool ctrdl_pickFreeRange(size_t size, u32 hint, u32* out) {
+    // Right after another object if possible, otherwise in the smallest range which fits.
+    const FreeRange* best = NULL;
+    for (size_t i = 0; i < g_NumFree; ++i) {
+        const FreeRange* r = &g_Free[i];
+        if (hint && (hint >= r->base) && ((hint - r->base) < r->size) && ((r->size - (hint - r->base)) >= size)) {
+            *out = hint;
+            return true;
+        }
+
+        if ((r->size >= size) && (!best || (r->size < best->size)))
+            best = r;
+    }
+
+    if (best) {
+        *out = best->base;
+        return true;
+    }
+
+    return false;
+}
+
+bool ctrdl_allocAddrSpace(size_t size, u32 hint, u32* out) {
+    bool ret = false;
+    ctrdl_acquireHandleMtx();
+
+    if (!ctrdl_initAddrSpace()) {
+        ctrdl_setLastError(Err_MapFailed);
+        goto end;
+    }
+
+    u32 addr;
+    while (ctrdl_pickFreeRange(size, hint, &addr)) {
+        // Something else might have mapped memory there, check with a single query.
+        CTRDLRegion region;
+        if (!ctrdl_queryRegion(addr, &region)) {
+            ctrdl_setLastError(Err_MapFailed);
+            goto end;
+        }
+
+        if (region.free && ((addr + size) <= (region.base + region.size))) {
+            ctrdl_carveAddrSpace(addr, size);
+            ret = true;
+            goto end;
+        }
+
+        // Forget the used region and try again.
+        ++g_NumStale;
+        if (region.free && !ctrdl_queryRegion(region.base + region.size, &region)) {
+            ctrdl_setLastError(Err_MapFailed);
+            goto end;
+        }
+
+        if (!ctrdl_carveAddrSpace(region.base, region.size))
+            break;
+    }
+
+    ++g_NumFallbacks;
+    ret = ctrdl_queryAddrSpace(size, &addr);
+    if (ret)
+        ctrdl_carveAddrSpace(addr, size);
+
+end:
+    if (ret)
+        *out = addr;
+
+    ctrdl_releaseHandleMtx();
+    return ret;
+}
+
+void ctrdl_freeAddrSpace(u32 addr, size_t size) {
+    ctrdl_acquireHandleMtx();
+
+    size_t index = 0;
+    while ((index < g_NumFree) && (g_Free[index].base < addr))
+        ++index;
+
+    // Merge with the neighbours.
+    const bool mergePrev = index && ((g_Free[index - 1].base + g_Free[index - 1].size) == addr);
+    const bool mergeNext = (index < g_NumFree) && ((addr + size) == g_Free[index].base);
+
+    if (mergePrev && mergeNext) {
+        g_Free[index - 1].size += size + g_Free[index].size;
+        ctrdl_eraseFreeRange(index);
+    } else if (mergePrev) {
+        g_Free[index - 1].size += size;
+    } else if (mergeNext) {
+        g_Free[index].base = addr;
+        g_Free[index].size += size;
+    } else {
+        // Without memory the range is lost, the fallback can still find it.
+        ctrdl_insertFreeRange(index, addr, size);
+    }
+
+    ctrdl_releaseHandleMtx();
+}
+
+void ctrdl_getAddrSpaceStats(CTRDLSpaceStats* out) {
+    ctrdl_acquireHandleMtx();
+
+    memset(out, 0, sizeof(CTRDLSpaceStats));
+    out->totalSize = g_SpaceSize;
+    out->numFreeRanges = g_NumFree;
+    out->numStale = g_NumStale;
+    out->numFallbacks = g_NumFallbacks;
+
+    for (size_t i = 0; i < g_NumFree; ++i) {
+        out->freeSize += g_Free[i].size;
+        if (g_Free[i].size > out->largestFree)
+            out->largestFree = g_Free[i].size;
+    }
+
+    ctrdl_releaseHandleMtx();
+}
@@ -0,0 +1,13 @@
+#ifndef _CTRDL_ADDRSPACE_H
+#define _CTRDL_ADDRSPACE_H
+
+#include <dlfcn.h>
+
+// Tracks the free ranges of the mirror space, so that placing an object doesn't walk the kernel regions.
+// The hint is an address the object should preferably start at, 0 for none.
+
+bool ctrdl_allocAddrSpace(size_t size, u32 hint, u32* out);
+void ctrdl_freeAddrSpace(u32 addr, size_t size);
+void ctrdl_getAddrSpaceStats(CTRDLSpaceStats* out);
+
+#endif /* _CTRDL_ADDRSPACE_H */
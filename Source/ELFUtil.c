@@ -1,5 +1,6 @@
 #include "ELFUtil.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -21,14 +22,83 @@ Elf32_Word ctrdl_getELFSymNameHash(const char* name) {
     return h;
 }
 
+Elf32_Word ctrdl_getELFGNUSymNameHash(const char* name) {
+    Elf32_Word h = 5381;
+
+    while (*name) {
+        h = (h << 5) + h + (u8)*name;
+        ++name;
+    }
+
+    return h;
+}
+
+static bool ctrdl_getRelTable(CTRDLElf* elf, Elf32_Sword arrayTag, Elf32_Sword sizeTag, Elf32_Sword entTag, size_t entSize, Elf32_Addr* offset, size_t* count) {
+    Elf32_Dyn array;
+    Elf32_Dyn size;
+    Elf32_Dyn ent;
+    const bool hasArray = ctrdl_getELFDynEntryWithTag(elf, arrayTag, &array);
+    const bool hasSize = ctrdl_getELFDynEntryWithTag(elf, sizeTag, &size);
+    const bool hasEnt = ctrdl_getELFDynEntryWithTag(elf, entTag, &ent);
+
+    *offset = 0;
+    *count = 0;
+
+    if (hasArray && hasSize && hasEnt) {
+        if (ent.d_un.d_val != entSize)
+            return false;
+
+        *offset = array.d_un.d_ptr;
+        *count = size.d_un.d_val / entSize;
+    }
+
+    return true;
+}
+
+static const Elf32_Phdr* ctrdl_findFileBackedSegment(CTRDLElf* elf, Elf32_Addr vaddr, size_t size) {
+    for (size_t i = 0; i < elf->header.e_phnum; ++i) {
+        const Elf32_Phdr* ph = &elf->segments[i];
+        if ((ph->p_type == PT_LOAD) && (vaddr >= ph->p_vaddr) && ((vaddr - ph->p_vaddr) <= ph->p_filesz) &&
+            (size <= (ph->p_filesz - (vaddr - ph->p_vaddr))))
+            return ph;
+    }
+
+    return NULL;
+}
+
+// Stream data can be referenced in place if it's suitably aligned.
+static const void* ctrdl_peekAligned(CTRDLStream* stream, size_t offset, size_t size) {
+    const void* data = ctrdl_streamPeek(stream, offset, size);
+    return ((uintptr_t)data & (sizeof(Elf32_Word) - 1)) ? NULL : data;
+}
+
+static void ctrdl_initRelTable(CTRDLElf* elf, CTRDLStream* stream, CTRDLRelTable* table, Elf32_Addr vaddr, size_t count, bool isRela) {
+    const size_t size = count * (isRela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel));
+    const Elf32_Phdr* segment = ctrdl_findFileBackedSegment(elf, vaddr, size);
+
+    table->vaddr = vaddr;
+    table->count = count;
+    table->relativeCount = 0;
+    table->isRela = isRela;
+    table->inImage = segment != NULL;
+    table->entries = NULL;
+
+    // Tables outside of any segment are addressed by file offset, and need no streaming if addressable.
+    table->offset = segment ? (segment->p_offset + (vaddr - segment->p_vaddr)) : vaddr;
+    if (!segment && count)
+        table->entries = ctrdl_peekAligned(stream, table->offset, size);
+}
+
 bool ctrdl_parseELF(CTRDLStream* stream, CTRDLElf* out) {
+    memset(out, 0, sizeof(CTRDLElf));
+
     // Read header.
-    if (!stream->seek(stream, 0)) {
+    if (!ctrdl_streamSeek(stream, 0)) {
         ctrdl_setLastError(Err_ReadFailed);
         return false;
     }
 
-    if (!stream->read(stream, &out->header, sizeof(Elf32_Ehdr))) {
+    if (!ctrdl_streamRead(stream, &out->header, sizeof(Elf32_Ehdr))) {
         ctrdl_setLastError(Err_ReadFailed);
         return false;
     }
@@ -58,309 +128,340 @@ bool ctrdl_parseELF(CTRDLStream* stream, CTRDLElf* out) {
         return false;
     }
 
-    // Read program headers.
-    if (!stream->seek(stream, out->header.e_phoff)) {
-        ctrdl_setLastError(Err_ReadFailed);
+    if (out->header.e_phentsize != sizeof(Elf32_Phdr)) {
+        ctrdl_setLastError(Err_InvalidObject);
         return false;
     }
 
-    out->segments = malloc(out->header.e_phoff * sizeof(Elf32_Phdr));
+    // Read program headers, usually right after the header.
+    const size_t segmentsSize = out->header.e_phnum * sizeof(Elf32_Phdr);
+    out->segments = ctrdl_peekAligned(stream, out->header.e_phoff, segmentsSize);
+    out->peekedSegments = out->segments != NULL;
+
     if (!out->segments) {
-        ctrdl_setLastError(Err_NoMemory);
-        return false;
-    }
+        Elf32_Phdr* segments = malloc(segmentsSize);
+        if (!segments) {
+            ctrdl_setLastError(Err_NoMemory);
+            return false;
+        }
 
-    for (size_t i = 0; i < out->header.e_phoff; ++i) {
-        if (!stream->read(stream, &out->segments[i], sizeof(Elf32_Phdr))) {
+        out->segments = segments;
+        if (!ctrdl_streamSeek(stream, out->header.e_phoff)) {
+            ctrdl_setLastError(Err_ReadFailed);
+            ctrdl_freeELF(out);
+            return false;
+        }
+
+        if (!ctrdl_streamRead(stream, segments, segmentsSize)) {
             ctrdl_setLastError(Err_ReadFailed);
             ctrdl_freeELF(out);
             return false;
         }
     }
 
-    // Read dyn entries.
+    // Read dyn entries, at least one as the last one is used as terminator.
     Elf32_Phdr dyn;
-    if (!ctrdl_getELFSegmentByType(out, PT_DYNAMIC, &dyn)) {
+    const size_t numDynEntries = ctrdl_getELFSegmentByType(out, PT_DYNAMIC, &dyn) ? (dyn.p_filesz / sizeof(Elf32_Dyn)) : 0;
+    if (!numDynEntries) {
         ctrdl_setLastError(Err_InvalidObject);
         ctrdl_freeELF(out);
         return false;
     }
 
-    if (!stream->seek(stream, dyn.p_offset)) {
-        ctrdl_setLastError(Err_InvalidObject);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    // Referenced in place only if already terminated.
+    out->dynEntries = ctrdl_peekAligned(stream, dyn.p_offset, numDynEntries * sizeof(Elf32_Dyn));
+    if (out->dynEntries && (out->dynEntries[numDynEntries - 1].d_tag != DT_NULL))
+        out->dynEntries = NULL;
+
+    out->peekedDynEntries = out->dynEntries != NULL;
 
-    out->dynEntries = malloc(dyn.p_filesz);
     if (!out->dynEntries) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_freeELF(out);
-        return false;
+        Elf32_Dyn* dynEntries = malloc(numDynEntries * sizeof(Elf32_Dyn));
+        if (!dynEntries) {
+            ctrdl_setLastError(Err_NoMemory);
+            ctrdl_freeELF(out);
+            return false;
+        }
+
+        out->dynEntries = dynEntries;
+        if (!ctrdl_streamSeek(stream, dyn.p_offset)) {
+            ctrdl_setLastError(Err_ReadFailed);
+            ctrdl_freeELF(out);
+            return false;
+        }
+
+        if (!ctrdl_streamRead(stream, dynEntries, numDynEntries * sizeof(Elf32_Dyn))) {
+            ctrdl_setLastError(Err_ReadFailed);
+            ctrdl_freeELF(out);
+            return false;
+        }
+
+        // Make sure the table is terminated.
+        dynEntries[numDynEntries - 1].d_tag = DT_NULL;
     }
 
-    if (!stream->read(stream, out->dynEntries, dyn.p_filesz)) {
+    // Symbol tables are resolved once the image is loaded.
+    Elf32_Dyn unused;
+    const bool hasHash = ctrdl_getELFDynEntryWithTag(out, DT_HASH, &unused) || ctrdl_getELFDynEntryWithTag(out, DT_GNU_HASH, &unused);
+    if (!hasHash || !ctrdl_getELFDynEntryWithTag(out, DT_SYMTAB, &unused) ||
+        !ctrdl_getELFDynEntryWithTag(out, DT_STRTAB, &unused) || !ctrdl_getELFDynEntryWithTag(out, DT_STRSZ, &unused)) {
         ctrdl_setLastError(Err_InvalidObject);
         ctrdl_freeELF(out);
         return false;
     }
 
-    // Read sym hash table.
-    Elf32_Dyn hash;
-    if (!ctrdl_getELFDynEntryWithTag(out, DT_HASH, &hash)) {
+    // Get reloc info, tables are applied straight from the image or streamed when relocating.
+    Elf32_Addr relOffset;
+    size_t numRel;
+    Elf32_Addr relaOffset;
+    size_t numRela;
+    if (!ctrdl_getRelTable(out, DT_REL, DT_RELSZ, DT_RELENT, sizeof(Elf32_Rel), &relOffset, &numRel) ||
+        !ctrdl_getRelTable(out, DT_RELA, DT_RELASZ, DT_RELAENT, sizeof(Elf32_Rela), &relaOffset, &numRela)) {
         ctrdl_setLastError(Err_InvalidObject);
         ctrdl_freeELF(out);
         return false;
     }
 
-    if (!stream->seek(stream, hash.d_un.d_ptr)) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    ctrdl_initRelTable(out, stream, &out->relTable, relOffset, numRel, false);
+    ctrdl_initRelTable(out, stream, &out->relaTable, relaOffset, numRela, true);
 
-    if (!stream->read(stream, &out->numOfSymBuckets, sizeof(Elf32_Word))) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    Elf32_Dyn jmpRelArray;
+    Elf32_Dyn jmpRelSize;
+    Elf32_Dyn jmpRelType;
+    const bool hasJmpRelArray = ctrdl_getELFDynEntryWithTag(out, DT_JMPREL, &jmpRelArray);
+    const bool hasJmpRelSize = ctrdl_getELFDynEntryWithTag(out, DT_PLTRELSZ, &jmpRelSize);
+    const bool hasJmpRelType = ctrdl_getELFDynEntryWithTag(out, DT_PLTREL, &jmpRelType);
+    const bool hasJmpRel = hasJmpRelArray && hasJmpRelSize && hasJmpRelType;
 
-    if (!stream->read(stream, &out->numOfSymChains, sizeof(Elf32_Word))) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
+    if (hasJmpRel) {
+        switch (jmpRelType.d_un.d_val) {
+            case DT_REL:
+                ctrdl_initRelTable(out, stream, &out->jmpRelTable, jmpRelArray.d_un.d_ptr, jmpRelSize.d_un.d_val / sizeof(Elf32_Rel), false);
+                break;
+            case DT_RELA:
+                ctrdl_initRelTable(out, stream, &out->jmpRelTable, jmpRelArray.d_un.d_ptr, jmpRelSize.d_un.d_val / sizeof(Elf32_Rela), true);
+                break;
+            default:
+                ctrdl_setLastError(Err_InvalidObject);
+                ctrdl_freeELF(out);
+                return false;
+        }
     }
 
-    out->symBuckets = malloc(out->numOfSymBuckets * sizeof(Elf32_Word));
-    if (!out->symBuckets) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    Elf32_Dyn pltGot;
+    if (ctrdl_getELFDynEntryWithTag(out, DT_PLTGOT, &pltGot))
+        out->pltGot = pltGot.d_un.d_ptr;
 
-    out->symChains = malloc(out->numOfSymChains * sizeof(Elf32_Word));
-    if (!out->symChains) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    // Counts of leading relative relocations, never trusted past the table.
+    Elf32_Dyn relCount;
+    if (ctrdl_getELFDynEntryWithTag(out, DT_RELCOUNT, &relCount))
+        out->relTable.relativeCount = (relCount.d_un.d_val < numRel) ? relCount.d_un.d_val : numRel;
 
-    if (!stream->read(stream, out->symBuckets, out->numOfSymBuckets * sizeof(Elf32_Word))) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    Elf32_Dyn relaCount;
+    if (ctrdl_getELFDynEntryWithTag(out, DT_RELACOUNT, &relaCount))
+        out->relaTable.relativeCount = (relaCount.d_un.d_val < numRela) ? relaCount.d_un.d_val : numRela;
 
-    if (!stream->read(stream, out->symChains, out->numOfSymChains * sizeof(Elf32_Word))) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    return true;
+}
 
-    // Read sym entries.
-    Elf32_Dyn symtab;
-    if (!ctrdl_getELFDynEntryWithTag(out, DT_SYMTAB, &symtab)) {
-        ctrdl_setLastError(Err_InvalidObject);
-        ctrdl_freeELF(out);
-        return false;
-    }
+static const void* ctrdl_getImagePtr(u32 image, size_t imageSize, Elf32_Addr vaddr, size_t size) {
+    if ((vaddr > imageSize) || (size > (imageSize - vaddr)))
+        return NULL;
 
-    if (!stream->seek(stream, symtab.d_un.d_ptr)) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    return (const void*)(image + vaddr);
+}
 
-    out->symEntries = malloc(out->numOfSymChains * sizeof(Elf32_Sym));
-    if (!out->symEntries) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_freeELF(out);
+static bool ctrdl_resolveSysVHash(CTRDLElf* elf, u32 image, size_t imageSize, Elf32_Addr vaddr) {
+    // Layout is nbucket, nchain, buckets, chains.
+    const Elf32_Word* hashTable = ctrdl_getImagePtr(image, imageSize, vaddr, 2 * sizeof(Elf32_Word));
+    if (!hashTable || !hashTable[0] || !hashTable[1])
         return false;
-    }
 
-    if (!stream->read(stream, out->symEntries, out->numOfSymChains * sizeof(Elf32_Sym))) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
-        return false;
-    }
+    const Elf32_Word numBuckets = hashTable[0];
+    const Elf32_Word numChains = hashTable[1];
+    const size_t maxWords = imageSize / sizeof(Elf32_Word);
 
-    // Read string table.
-    Elf32_Dyn strtab;
-    if (!ctrdl_getELFDynEntryWithTag(out, DT_STRTAB, &strtab)) {
-        ctrdl_setLastError(Err_InvalidObject);
-        ctrdl_freeELF(out);
+    // Reject counts first, the table size could wrap otherwise.
+    if ((numBuckets > maxWords) || (numChains > (maxWords - numBuckets)))
         return false;
-    }
 
-    if (!stream->seek(stream, strtab.d_un.d_ptr)) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
+    if (!ctrdl_getImagePtr(image, imageSize, vaddr, (2 + numBuckets + numChains) * sizeof(Elf32_Word)))
         return false;
-    }
 
-    Elf32_Dyn strsz;
-    if (!ctrdl_getELFDynEntryWithTag(out, DT_STRSZ, &strsz)) {
-        ctrdl_setLastError(Err_InvalidObject);
-        ctrdl_freeELF(out);
+    elf->hasGNUHash = false;
+    elf->numOfSymBuckets = numBuckets;
+    elf->symBuckets = &hashTable[2];
+    elf->numOfSymChains = numChains;
+    elf->symChains = &hashTable[2 + numBuckets];
+    return true;
+}
+
+static bool ctrdl_resolveGNUHash(CTRDLElf* elf, u32 image, size_t imageSize, Elf32_Addr vaddr) {
+    // Layout is nbucket, symoffset, bloom size, bloom shift, bloom, buckets, chains.
+    const Elf32_Word* hashTable = ctrdl_getImagePtr(image, imageSize, vaddr, 4 * sizeof(Elf32_Word));
+    if (!hashTable || !hashTable[0] || !hashTable[2] || (hashTable[2] & (hashTable[2] - 1)))
         return false;
-    }
 
-    out->stringTable = malloc(strsz.d_un.d_val);
-    if (!out->stringTable) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_freeELF(out);
+    const Elf32_Word numBuckets = hashTable[0];
+    const Elf32_Word symOffset = hashTable[1];
+    const Elf32_Word bloomSize = hashTable[2];
+    const size_t maxWords = imageSize / sizeof(Elf32_Word);
+
+    // Reject counts first, the header size could wrap otherwise.
+    if ((bloomSize > maxWords) || (numBuckets > (maxWords - bloomSize)))
         return false;
-    }
 
-    if (!stream->read(stream, out->stringTable, strsz.d_un.d_val)) {
-        ctrdl_setLastError(Err_ReadFailed);
-        ctrdl_freeELF(out);
+    const size_t headerSize = (4 + bloomSize + numBuckets) * sizeof(Elf32_Word);
+    if (!ctrdl_getImagePtr(image, imageSize, vaddr, headerSize))
         return false;
+
+    const Elf32_Word* buckets = &hashTable[4 + bloomSize];
+    const Elf32_Word* chains = &hashTable[4 + bloomSize + numBuckets];
+
+    // The symbol count isn't stored, find the end of the last chain.
+    Elf32_Word lastSym = 0;
+    for (size_t i = 0; i < numBuckets; ++i) {
+        if (buckets[i] > lastSym)
+            lastSym = buckets[i];
     }
 
-    // Read reloc info.
-    Elf32_Dyn jmpRelArray;
-    Elf32_Dyn jmpRelSize;
-    Elf32_Dyn jmpRelType;
-    const bool hasJmpRelArray = ctrdl_getELFDynEntryWithTag(out, DT_JMPREL, &jmpRelArray);
-    const bool hasJmpRelSize = ctrdl_getELFDynEntryWithTag(out, DT_PLTRELSZ, &jmpRelSize);
-    const bool hasJmpRelType = ctrdl_getELFDynEntryWithTag(out, DT_PLTREL, &jmpRelType);
-    const bool hasJmpRel = hasJmpRelArray && hasJmpRelSize && hasJmpRelType;
+    size_t numSyms = symOffset;
+    if (lastSym >= symOffset) {
+        while (true) {
+            if ((lastSym - symOffset) > maxWords)
+                return false;
 
-    size_t numActuallyJmpRel = 0;
-    if (hasJmpRel) {
-        switch (jmpRelType.d_un.d_val) {
-            case DT_REL:
-                numActuallyJmpRel = jmpRelSize.d_un.d_val / sizeof(Elf32_Rel);
-                out->relArraySize = numActuallyJmpRel;
-                out->relaArraySize = 0;
-                break;
-            case DT_RELA:
-                numActuallyJmpRel = jmpRelSize.d_un.d_val / sizeof(Elf32_Rela);
-                out->relArraySize = 0;
-                out->relaArraySize = numActuallyJmpRel;
-                break;
-            default:
-                ctrdl_setLastError(Err_InvalidObject);
-                ctrdl_freeELF(out);
+            const Elf32_Addr chainAddr = vaddr + headerSize + (lastSym - symOffset) * sizeof(Elf32_Word);
+            const Elf32_Word* chain = ctrdl_getImagePtr(image, imageSize, chainAddr, sizeof(Elf32_Word));
+            if (!chain)
                 return false;
+
+            if (*chain & 1)
+                break;
+
+            ++lastSym;
         }
-    }
 
-    Elf32_Dyn relArray;
-    Elf32_Dyn relSize;
-    Elf32_Dyn relEnt;
-    const bool hasRelArray = ctrdl_getELFDynEntryWithTag(out, DT_REL, &relArray);
-    const bool hasRelSize = ctrdl_getELFDynEntryWithTag(out, DT_RELSZ, &relSize);
-    const bool hasRelEnt = ctrdl_getELFDynEntryWithTag(out, DT_RELENT, &relEnt);
-    const bool hasRel = hasRelArray && hasRelSize && hasRelEnt;
-
-    size_t numActuallyRel = 0;
-    if (hasRel) {
-        numActuallyRel = (relSize.d_un.d_val / relEnt.d_un.d_val);
-        out->relArraySize += numActuallyRel;
+        numSyms = lastSym + 1;
     }
 
-    if (out->relArraySize) {
-        out->relArray = malloc(out->relArraySize * sizeof(Elf32_Rel));
-        if (!out->relArray) {
-            ctrdl_setLastError(Err_NoMemory);
-            ctrdl_freeELF(out);
-            return false;
-        }
+    elf->hasGNUHash = true;
+    elf->symOffset = symOffset;
+    elf->bloomSize = bloomSize;
+    elf->bloomShift = hashTable[3];
+    elf->bloom = &hashTable[4];
+    elf->numOfSymBuckets = numBuckets;
+    elf->symBuckets = buckets;
+    elf->numOfSymChains = numSyms;
+    elf->symChains = chains;
+    return true;
+}
 
-        if (!stream->seek(stream, relArray.d_un.d_ptr)) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
-            return false;
-        }
+static bool ctrdl_resolvePackedTable(CTRDLElf* elf, u32 image, size_t imageSize, Elf32_Sword arrayTag, Elf32_Sword sizeTag, const void** out, size_t* outSize) {
+    Elf32_Dyn array;
+    Elf32_Dyn size;
+    const bool hasArray = ctrdl_getELFDynEntryWithTag(elf, arrayTag, &array);
+    const bool hasSize = ctrdl_getELFDynEntryWithTag(elf, sizeTag, &size);
 
-        if (!stream->read(stream, out->relArray, numActuallyRel * sizeof(Elf32_Rel))) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
-            return false;
-        }
+    if (!hasArray && !hasSize) {
+        *out = NULL;
+        *outSize = 0;
+        return true;
     }
 
-    Elf32_Dyn relaArray;
-    Elf32_Dyn relaSize;
-    Elf32_Dyn relaEnt;
-    const bool hasRelaArray = ctrdl_getELFDynEntryWithTag(out, DT_RELA, &relaArray);
-    const bool hasRelaSize = ctrdl_getELFDynEntryWithTag(out, DT_RELASZ, &relaSize);
-    const bool hasRelaEnt = ctrdl_getELFDynEntryWithTag(out, DT_RELAENT, &relaEnt);
-    const bool hasRela = hasRelaArray && hasRelaSize && hasRelaEnt;
-
-    size_t numActuallyRela = 0;
-    if (hasRela) {
-        numActuallyRela = (relaSize.d_un.d_val / relaEnt.d_un.d_val);
-        out->relaArraySize += numActuallyRela;
-    }
+    if (!hasArray || !hasSize)
+        return false;
 
-    if (out->relaArraySize) {
-        out->relaArray = malloc(out->relaArraySize * sizeof(Elf32_Rela));
-        if (!out->relaArray) {
-            ctrdl_setLastError(Err_NoMemory);
-            ctrdl_freeELF(out);
-            return false;
-        }
+    *out = ctrdl_getImagePtr(image, imageSize, array.d_un.d_ptr, size.d_un.d_val);
+    *outSize = size.d_un.d_val;
+    return *out != NULL;
+}
 
-        if (!stream->seek(stream, relaArray.d_un.d_ptr)) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
-            return false;
-        }
+static bool ctrdl_resolvePackedRelocs(CTRDLElf* elf, u32 image, size_t imageSize) {
+    Elf32_Dyn relrEnt;
+    if (ctrdl_getELFDynEntryWithTag(elf, DT_RELRENT, &relrEnt) && (relrEnt.d_un.d_val != sizeof(Elf32_Word)))
+        return false;
 
-        if (!stream->read(stream, out->relaArray, numActuallyRela * sizeof(Elf32_Rela))) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
+    const void* relr;
+    size_t relrSize;
+    if (!ctrdl_resolvePackedTable(elf, image, imageSize, DT_RELR, DT_RELRSZ, &relr, &relrSize) || (relrSize % sizeof(Elf32_Word)))
+        return false;
+
+    elf->relrArray = relr;
+    elf->relrArraySize = relrSize / sizeof(Elf32_Word);
+
+    // Android packed tables start with the "APS2" magic.
+    if (!ctrdl_resolvePackedTable(elf, image, imageSize, DT_ANDROID_REL, DT_ANDROID_RELSZ, &elf->androidRel, &elf->androidRelSize) ||
+        !ctrdl_resolvePackedTable(elf, image, imageSize, DT_ANDROID_RELA, DT_ANDROID_RELASZ, &elf->androidRela, &elf->androidRelaSize))
+        return false;
+
+    if (elf->androidRel && ((elf->androidRelSize < 4) || memcmp(elf->androidRel, "APS2", 4)))
+        return false;
+
+    if (elf->androidRela && ((elf->androidRelaSize < 4) || memcmp(elf->androidRela, "APS2", 4)))
+        return false;
+
+    return true;
+}
+
+bool ctrdl_resolveELFTables(CTRDLElf* elf, u32 image, size_t imageSize) {
+    Elf32_Dyn hash;
+    Elf32_Dyn symtab;
+    Elf32_Dyn strtab;
+    Elf32_Dyn strsz;
+    ctrdl_getELFDynEntryWithTag(elf, DT_SYMTAB, &symtab);
+    ctrdl_getELFDynEntryWithTag(elf, DT_STRTAB, &strtab);
+    ctrdl_getELFDynEntryWithTag(elf, DT_STRSZ, &strsz);
+
+    // Prefer the GNU hash table, which can reject missing symbols early.
+    if (ctrdl_getELFDynEntryWithTag(elf, DT_GNU_HASH, &hash)) {
+        if (!ctrdl_resolveGNUHash(elf, image, imageSize, hash.d_un.d_ptr))
+            return false;
+    } else {
+        ctrdl_getELFDynEntryWithTag(elf, DT_HASH, &hash);
+        if (!ctrdl_resolveSysVHash(elf, image, imageSize, hash.d_un.d_ptr))
             return false;
-        }
     }
 
-    if (hasJmpRel) {
-        void* dst = NULL;
-        size_t toRead = 0;
-
-        if (jmpRelType.d_un.d_val == DT_REL) {
-            dst = out->relArray + numActuallyRel;
-            toRead = numActuallyJmpRel * sizeof(Elf32_Rel);
-        } else {
-            dst = out->relaArray + numActuallyRela;
-            toRead = numActuallyJmpRel * sizeof(Elf32_Rela);
-        }
+    const Elf32_Word numChains = elf->numOfSymChains;
+    if (numChains > (imageSize / sizeof(Elf32_Sym)))
+        return false;
 
-        if (!stream->seek(stream, jmpRelArray.d_un.d_ptr)) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
-            return false;
-        }
+    const Elf32_Sym* symEntries = ctrdl_getImagePtr(image, imageSize, symtab.d_un.d_ptr, numChains * sizeof(Elf32_Sym));
+    const char* stringTable = ctrdl_getImagePtr(image, imageSize, strtab.d_un.d_ptr, strsz.d_un.d_val);
+    if (!symEntries || !stringTable || !strsz.d_un.d_val || stringTable[strsz.d_un.d_val - 1])
+        return false;
 
-        if (!stream->read(stream, dst, toRead)) {
-            ctrdl_setLastError(Err_ReadFailed);
-            ctrdl_freeELF(out);
+    elf->symEntries = symEntries;
+    elf->stringTable = stringTable;
+
+    CTRDLRelTable* relTables[] = { &elf->relTable, &elf->relaTable, &elf->jmpRelTable };
+    for (size_t i = 0; i < (sizeof(relTables) / sizeof(relTables[0])); ++i) {
+        CTRDLRelTable* table = relTables[i];
+        const size_t size = table->count * (table->isRela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel));
+        if (table->inImage && !(table->entries = ctrdl_getImagePtr(image, imageSize, table->vaddr, size)))
             return false;
-        }
     }
 
-    return true;
+    return ctrdl_resolvePackedRelocs(elf, image, imageSize);
 }
 
 void ctrdl_freeELF(CTRDLElf* elf) {
-    free(elf->segments);
-    free(elf->dynEntries);
-    free(elf->symBuckets);
-    free(elf->symChains);
-    free(elf->symEntries);
-    free(elf->stringTable);
-    free(elf->relArray);
-    free(elf->relaArray);
+    if (!elf->peekedSegments)
+        free((void*)elf->segments);
+
+    if (!elf->peekedDynEntries)
+        free((void*)elf->dynEntries);
+
+    elf->segments = NULL;
+    elf->dynEntries = NULL;
 }
 
 size_t ctrdl_getELFNumSegmentsByType(CTRDLElf* elf, Elf32_Word type) {
     size_t count = 0;
 
     for (size_t i = 0; i < elf->header.e_phnum; ++i) {
-        Elf32_Phdr* ph = &elf->segments[i];
+        const Elf32_Phdr* ph = &elf->segments[i];
         if (ph->p_type == type)
             ++count;
     }
@@ -372,7 +473,7 @@ size_t ctrdl_getELFSegmentsByType(CTRDLElf* elf, Elf32_Word type, Elf32_Phdr* ou
     size_t count = 0;
 
     for (size_t i = 0; i < elf->header.e_phnum; ++i) {
-        Elf32_Phdr* ph = &elf->segments[i];
+        const Elf32_Phdr* ph = &elf->segments[i];
         if (ph->p_type == type) {
             memcpy(&out[count], ph, sizeof(Elf32_Phdr));
             ++count;
@@ -387,7 +488,7 @@ size_t ctrdl_getELFSegmentsByType(CTRDLElf* elf, Elf32_Word type, Elf32_Phdr* ou
 
 size_t ctrdl_getELFNumDynEntriesWithTag(CTRDLElf* elf, Elf32_Sword tag) {
     size_t count = 0;
-    Elf32_Dyn* entry = elf->dynEntries;
+    const Elf32_Dyn* entry = elf->dynEntries;
 
     while (entry->d_tag != DT_NULL) {
         if (entry->d_tag == tag) {
@@ -402,9 +503,9 @@ size_t ctrdl_getELFNumDynEntriesWithTag(CTRDLElf* elf, Elf32_Sword tag) {
 
 size_t ctrdl_getELFDynEntriesWithTag(CTRDLElf* elf, Elf32_Sword tag, Elf32_Dyn* out, size_t maxSize) {
     size_t count = 0;
-    Elf32_Dyn* entry = elf->dynEntries;
+    const Elf32_Dyn* entry = elf->dynEntries;
 
-    while (entry->d_tag != DT_NULL) {
+    while ((entry->d_tag != DT_NULL) && (count < maxSize)) {
         if (entry->d_tag == tag) {
             memcpy(&out[count], entry, sizeof(Elf32_Dyn));
             ++count;
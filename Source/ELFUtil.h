@@ -1,45 +1,98 @@
 #ifndef _CTRDL_ELFUTIL_H
 #define _CTRDL_ELFUTIL_H
 
-#include "CTRL/Types.h"
-
 #include "Error.h"
+#include "Platform.h"
 #include "Stream.h"
 
 #include <elf.h>
 #include <string.h>
 
+#ifndef DT_GNU_HASH
+#define DT_GNU_HASH 0x6FFFFEF5
+#endif
+
+#ifndef DT_RELRSZ
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#define DT_RELRENT 37
+#endif
+
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL 0x6000000F
+#define DT_ANDROID_RELSZ 0x60000010
+#define DT_ANDROID_RELA 0x60000011
+#define DT_ANDROID_RELASZ 0x60000012
+#endif
+
+#ifndef DT_RELACOUNT
+#define DT_RELACOUNT 0x6FFFFFF9
+#endif
+
+#ifndef DT_RELCOUNT
+#define DT_RELCOUNT 0x6FFFFFFA
+#endif
+
+typedef struct {
+    Elf32_Addr vaddr;     // Table address.
+    size_t offset;        // Stream offset.
+    size_t count;         // Number of entries.
+    size_t relativeCount; // Leading R_ARM_RELATIVE entries (DT_RELCOUNT).
+    bool isRela;          // Whether entries are Elf32_Rela.
+    bool inImage;         // Whether the table is loaded along with a segment.
+    const void* entries;  // Entries in the loaded image or the stream, NULL if they must be streamed.
+} CTRDLRelTable;
+
 typedef struct {
     Elf32_Ehdr header;
-    Elf32_Phdr* segments;
-    Elf32_Dyn* dynEntries;
+    const Elf32_Phdr* segments;
+    const Elf32_Dyn* dynEntries;
+    bool peekedSegments;   // Whether segments point into the stream, and aren't freed.
+    bool peekedDynEntries; // Whether dyn entries point into the stream, and aren't freed.
+    // Symbol tables, these point into the loaded image.
+    // For GNU hash tables chains start at symOffset and numOfSymChains is the symbol count.
+    bool hasGNUHash;
+    Elf32_Word symOffset;
+    Elf32_Word bloomSize;
+    Elf32_Word bloomShift;
+    const Elf32_Word* bloom;
     Elf32_Word numOfSymBuckets;
-    Elf32_Word* symBuckets;
+    const Elf32_Word* symBuckets;
     Elf32_Word numOfSymChains;
-    Elf32_Word* symChains;
-    Elf32_Sym* symEntries;
-    char* stringTable;
-    Elf32_Rel* relArray;
-    size_t relArraySize;
-    Elf32_Rela* relaArray;
-    size_t relaArraySize;
+    const Elf32_Word* symChains;
+    const Elf32_Sym* symEntries;
+    const char* stringTable;
+    // Relocation tables.
+    CTRDLRelTable relTable;
+    CTRDLRelTable relaTable;
+    CTRDLRelTable jmpRelTable;
+    Elf32_Addr pltGot;
+    // Packed relocations, these point into the loaded image.
+    const Elf32_Word* relrArray;
+    size_t relrArraySize;
+    const void* androidRel;
+    size_t androidRelSize;
+    const void* androidRela;
+    size_t androidRelaSize;
 } CTRDLElf;
 
 Elf32_Word ctrdl_getELFSymNameHash(const char* name);
+Elf32_Word ctrdl_getELFGNUSymNameHash(const char* name);
 bool ctrdl_parseELF(CTRDLStream* stream, CTRDLElf* out);
+bool ctrdl_resolveELFTables(CTRDLElf* elf, u32 image, size_t imageSize);
 void ctrdl_freeELF(CTRDLElf* elf);
 
 size_t ctrdl_getELFNumSegmentsByType(CTRDLElf* elf, Elf32_Word type);
 size_t ctrdl_getELFSegmentsByType(CTRDLElf* elf, Elf32_Word type, Elf32_Phdr* out, size_t maxSize);
 
-CTRL_INLINE bool ctrdl_getELFSegmentByType(CTRDLElf* elf, Elf32_Word type, Elf32_Phdr* out) {
+CTRDL_INLINE bool ctrdl_getELFSegmentByType(CTRDLElf* elf, Elf32_Word type, Elf32_Phdr* out) {
     return ctrdl_getELFSegmentsByType(elf, type, out, 1);
 }
 
 size_t ctrdl_getELFNumDynEntriesWithTag(CTRDLElf* elf, Elf32_Sword tag);
 size_t ctrdl_getELFDynEntriesWithTag(CTRDLElf* elf, Elf32_Sword tag, Elf32_Dyn* out, size_t maxSize);
 
-CTRL_INLINE bool ctrdl_getELFDynEntryWithTag(CTRDLElf* elf, Elf32_Sword tag, Elf32_Dyn* out) {
+CTRDL_INLINE bool ctrdl_getELFDynEntryWithTag(CTRDLElf* elf, Elf32_Sword tag, Elf32_Dyn* out) {
     return ctrdl_getELFDynEntriesWithTag(elf, tag, out, 1);
 }
 
@@ -41,6 +41,8 @@ const char* ctrdl_getErrorAsString(CTRDLError error) {
 			return "could not load dependency";
 		case Err_FreeFailed:
 			return "could not unload object";
+		case Err_PrivateMapping:
+			return "the buffer is not a shared mapping";
 	};
 
 	return NULL;
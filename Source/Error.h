@@ -19,6 +19,7 @@ typedef enum {
     Err_DepsLimit,
     Err_DepFailed,
     Err_FreeFailed,
+    Err_PrivateMapping,
 } CTRDLError;
 
 CTRDLError ctrdl_getLastError(void);
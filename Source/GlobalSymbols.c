@@ -0,0 +1,218 @@
+#include "GlobalSymbols.h"
+#include "Error.h"
+#include "Symbol.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CAPACITY 64
+#define MIN_GLOBALS_CAPACITY 8
+
+typedef struct {
+    Elf32_Word hash;      // GNU hash of the name.
+    const char* name;     // Symbol name (mapped), NULL if the slot is empty.
+    const Elf32_Sym* sym; // Symbol entry (mapped).
+    CTRDLHandle* owner;   // Object defining the symbol.
+} GlobalSym;
+
+// Open addressing with linear probing, the capacity is a power of two.
+static GlobalSym* g_Syms = NULL;
+static size_t g_NumSyms = 0;
+static size_t g_Capacity = 0;
+
+// Global objects in load order.
+static CTRDLHandle** g_Globals = NULL;
+static size_t g_NumGlobals = 0;
+static size_t g_GlobalsCapacity = 0;
+
+static CTRDL_INLINE bool ctrdl_isExported(const Elf32_Sym* sym) {
+    return sym->st_name && (sym->st_shndx != SHN_UNDEF) && (ELF32_ST_BIND(sym->st_info) != STB_LOCAL);
+}
+
+static GlobalSym* ctrdl_probeGlobalSym(Elf32_Word hash, const char* name) {
+    const size_t mask = g_Capacity - 1;
+    size_t index = hash & mask;
+
+    while (g_Syms[index].name) {
+        if ((g_Syms[index].hash == hash) && !strcmp(g_Syms[index].name, name))
+            break;
+
+        index = (index + 1) & mask;
+    }
+
+    return &g_Syms[index];
+}
+
+static void ctrdl_insertGlobalSym(Elf32_Word hash, const char* name, const Elf32_Sym* sym, CTRDLHandle* owner) {
+    GlobalSym* slot = ctrdl_probeGlobalSym(hash, name);
+
+    // Keep the first definition.
+    if (!slot->name) {
+        slot->hash = hash;
+        slot->name = name;
+        slot->sym = sym;
+        slot->owner = owner;
+        ++g_NumSyms;
+    }
+}
+
+static void ctrdl_eraseGlobalSym(size_t index) {
+    const size_t mask = g_Capacity - 1;
+
+    // Shift back the entries which would become unreachable.
+    size_t hole = index;
+    size_t next = (index + 1) & mask;
+    while (g_Syms[next].name) {
+        const size_t home = g_Syms[next].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            g_Syms[hole] = g_Syms[next];
+            hole = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    g_Syms[hole].name = NULL;
+    --g_NumSyms;
+}
+
+static bool ctrdl_reserveGlobalSyms(size_t count) {
+    // Keep the load factor under 1/2.
+    size_t capacity = g_Capacity ? g_Capacity : MIN_CAPACITY;
+    while (capacity < ((g_NumSyms + count) * 2))
+        capacity *= 2;
+
+    if (capacity == g_Capacity)
+        return true;
+
+    GlobalSym* oldSyms = g_Syms;
+    const size_t oldCapacity = g_Capacity;
+
+    g_Syms = calloc(capacity, sizeof(GlobalSym));
+    if (!g_Syms) {
+        g_Syms = oldSyms;
+        return false;
+    }
+
+    g_Capacity = capacity;
+    g_NumSyms = 0;
+
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        const GlobalSym* s = &oldSyms[i];
+        if (s->name)
+            ctrdl_insertGlobalSym(s->hash, s->name, s->sym, s->owner);
+    }
+
+    free(oldSyms);
+    return true;
+}
+
+bool ctrdl_addGlobalSymbols(CTRDLHandle* handle) {
+    bool ret = false;
+    ctrdl_acquireHandleMtx();
+
+    for (size_t i = 0; i < g_NumGlobals; ++i) {
+        if (g_Globals[i] == handle) {
+            ret = true;
+            goto end;
+        }
+    }
+
+    if (g_NumGlobals >= g_GlobalsCapacity) {
+        const size_t capacity = g_GlobalsCapacity ? (g_GlobalsCapacity * 2) : MIN_GLOBALS_CAPACITY;
+        CTRDLHandle** globals = realloc(g_Globals, capacity * sizeof(CTRDLHandle*));
+        if (!globals) {
+            ctrdl_setLastError(Err_NoMemory);
+            goto end;
+        }
+
+        g_Globals = globals;
+        g_GlobalsCapacity = capacity;
+    }
+
+    size_t count = 0;
+    for (size_t i = 1; i < handle->numSymChains; ++i) {
+        if (ctrdl_isExported(&handle->symEntries[i]))
+            ++count;
+    }
+
+    if (!ctrdl_reserveGlobalSyms(count)) {
+        ctrdl_setLastError(Err_NoMemory);
+        goto end;
+    }
+
+    for (size_t i = 1; i < handle->numSymChains; ++i) {
+        const Elf32_Sym* sym = &handle->symEntries[i];
+        if (ctrdl_isExported(sym)) {
+            const char* name = &handle->stringTable[sym->st_name];
+            ctrdl_insertGlobalSym(ctrdl_getELFGNUSymNameHash(name), name, sym, handle);
+        }
+    }
+
+    g_Globals[g_NumGlobals++] = handle;
+    ret = true;
+
+end:
+    ctrdl_releaseHandleMtx();
+    return ret;
+}
+
+void ctrdl_removeGlobalSymbols(CTRDLHandle* handle) {
+    ctrdl_acquireHandleMtx();
+
+    size_t globalIndex = 0;
+    while ((globalIndex < g_NumGlobals) && (g_Globals[globalIndex] != handle))
+        ++globalIndex;
+
+    if (globalIndex < g_NumGlobals) {
+        memmove(&g_Globals[globalIndex], &g_Globals[globalIndex + 1], (g_NumGlobals - globalIndex - 1) * sizeof(CTRDLHandle*));
+        --g_NumGlobals;
+
+        // Erasing shifts entries back into the current slot, so check it again.
+        size_t i = 0;
+        while (i < g_Capacity) {
+            if (g_Syms[i].name && (g_Syms[i].owner == handle)) {
+                ctrdl_eraseGlobalSym(i);
+            } else {
+                ++i;
+            }
+        }
+
+        // Definitions which were shadowed by this object become visible.
+        for (size_t i = 1; i < handle->numSymChains; ++i) {
+            const Elf32_Sym* sym = &handle->symEntries[i];
+            if (!ctrdl_isExported(sym))
+                continue;
+
+            const char* name = &handle->stringTable[sym->st_name];
+            const Elf32_Word hash = ctrdl_getELFGNUSymNameHash(name);
+            if (ctrdl_probeGlobalSym(hash, name)->name)
+                continue;
+
+            for (size_t j = 0; j < g_NumGlobals; ++j) {
+                const Elf32_Sym* found = ctrdl_unsafeFindSymbolFromName(g_Globals[j], name);
+                if (found) {
+                    // Names must stay valid after this object is unmapped.
+                    ctrdl_insertGlobalSym(hash, &g_Globals[j]->stringTable[found->st_name], found, g_Globals[j]);
+                    break;
+                }
+            }
+        }
+    }
+
+    ctrdl_releaseHandleMtx();
+}
+
+const Elf32_Sym* ctrdl_unsafeFindGlobalSymbol(const char* name, CTRDLHandle** owner) {
+    if (!g_NumSyms)
+        return NULL;
+
+    const GlobalSym* slot = ctrdl_probeGlobalSym(ctrdl_getELFGNUSymNameHash(name), name);
+    if (!slot->name)
+        return NULL;
+
+    if (owner)
+        *owner = slot->owner;
+
+    return slot->sym;
+}
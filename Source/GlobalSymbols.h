@@ -0,0 +1,15 @@
+#ifndef _CTRDL_GLOBALSYMBOLS_H
+#define _CTRDL_GLOBALSYMBOLS_H
+
+#include "Handle.h"
+
+// Merged index of the symbols exported by RTLD_GLOBAL objects.
+// When several objects define the same name, the one loaded first wins.
+
+bool ctrdl_addGlobalSymbols(CTRDLHandle* handle);
+void ctrdl_removeGlobalSymbols(CTRDLHandle* handle);
+
+// The handle mutex must be held while using the result.
+const Elf32_Sym* ctrdl_unsafeFindGlobalSymbol(const char* name, CTRDLHandle** owner);
+
+#endif /* _CTRDL_GLOBALSYMBOLS_H */
@@ -5,40 +5,180 @@
 #include <stdlib.h>
 #include <string.h>
 
-static CTRDLHandle g_Handles[CTRDL_MAX_HANDLES] = {};
-static RecursiveLock g_Mtx;
+#define HANDLE_SLAB_SIZE 16
+#define MIN_RANGE_CAPACITY 16
+#define MAX_RANGE_READ_ATTEMPTS 4
 
-static void ctrdl_handleMtxLazyInit(void) {
-    static u8 initialized = 0;
+// Handles are allocated in slabs which are never released, so that they don't move.
+static CTRDLHandle* g_FreeHandles = NULL;
+static CTRDLHandle* g_FirstHandle = NULL;
+static CTRDLHandle* g_LastHandle = NULL;
+static u32 g_Generation = 0;
+static CTRDLMutex g_Mtx = CTRDL_MUTEX_INIT;
 
-    if (!__ldrexb(&initialized)) {
-        RecursiveLock_Init(&g_Mtx);
+typedef struct {
+    u32 base;            // Mirror address of mapped region.
+    u32 end;             // End of mapped region (exclusive).
+    CTRDLHandle* handle; // Object mapped there.
+} CTRDLRange;
 
-        while (__strexb(&initialized, 1))
-            __ldrexb(&initialized);
-    } else {
-        __clrex();
+typedef struct CTRDLRangeArray {
+    struct CTRDLRangeArray* retired; // Previous (smaller) array.
+    size_t capacity;                 // Number of ranges.
+    CTRDLRange ranges[];             // Ranges.
+} CTRDLRangeArray;
+
+// Mapped regions sorted by base, written under the handle mutex.
+// Readers don't lock, they retry when the sequence changed or is odd (write in progress).
+// Arrays replaced on growth are kept, as readers might still be using them.
+static CTRDLRangeArray* g_Ranges = NULL;
+static size_t g_NumRanges = 0;
+static u32 g_RangeSeq = 0;
+
+static CTRDL_INLINE void ctrdl_beginRangeWrite(void) {
+    __atomic_store_n(&g_RangeSeq, g_RangeSeq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static CTRDL_INLINE void ctrdl_endRangeWrite(void) { __atomic_store_n(&g_RangeSeq, g_RangeSeq + 1, __ATOMIC_RELEASE); }
+
+static CTRDL_INLINE void ctrdl_storeRange(CTRDLRange* dst, const CTRDLRange* src) {
+    __atomic_store_n(&dst->base, src->base, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->end, src->end, __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->handle, src->handle, __ATOMIC_RELAXED);
+}
+
+#define MIN_NAME_CAPACITY 32
+#define NAME_BUFFER_SIZE 256
+
+// Open addressing with linear probing over canonical paths, the capacity is a power of two.
+static CTRDLHandle** g_Names = NULL;
+static size_t g_NumNames = 0;
+static size_t g_NameCapacity = 0;
+
+// Output is at most as long as the path.
+static void ctrdl_canonicalizePath(const char* path, char* out) {
+    // Paths without a device are relative to sdmc.
+    if (!strncmp(path, "sdmc:", 5))
+        path += 5;
+
+    char* p = out;
+    if (*path == '/')
+        *p++ = '/';
+
+    while (*path) {
+        const char* end = strchr(path, '/');
+        const size_t size = end ? (size_t)(end - path) : strlen(path);
+
+        // Skip duplicate slashes and "." components.
+        if (size && !((size == 1) && (path[0] == '.'))) {
+            if ((p != out) && (p[-1] != '/'))
+                *p++ = '/';
+
+            memcpy(p, path, size);
+            p += size;
+        }
+
+        path += size;
+        if (*path == '/')
+            ++path;
+    }
+
+    *p = '\0';
+}
+
+static size_t ctrdl_probeName(Elf32_Word hash, const char* canonPath) {
+    const size_t mask = g_NameCapacity - 1;
+    size_t index = hash & mask;
+
+    while (g_Names[index]) {
+        if ((g_Names[index]->pathHash == hash) && !strcmp(g_Names[index]->canonPath, canonPath))
+            break;
+
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+static bool ctrdl_addName(CTRDLHandle* handle) {
+    // Keep the load factor under 1/2.
+    size_t capacity = g_NameCapacity ? g_NameCapacity : MIN_NAME_CAPACITY;
+    while (capacity < ((g_NumNames + 1) * 2))
+        capacity *= 2;
+
+    if (capacity != g_NameCapacity) {
+        CTRDLHandle** oldNames = g_Names;
+        const size_t oldCapacity = g_NameCapacity;
+
+        g_Names = calloc(capacity, sizeof(CTRDLHandle*));
+        if (!g_Names) {
+            g_Names = oldNames;
+            return false;
+        }
+
+        g_NameCapacity = capacity;
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldNames[i])
+                g_Names[ctrdl_probeName(oldNames[i]->pathHash, oldNames[i]->canonPath)] = oldNames[i];
+        }
+
+        free(oldNames);
     }
+
+    // An object still being unloaded might have the same path, the new one replaces it.
+    const size_t index = ctrdl_probeName(handle->pathHash, handle->canonPath);
+    if (!g_Names[index])
+        ++g_NumNames;
+
+    g_Names[index] = handle;
+
+    return true;
 }
 
-void ctrdl_acquireHandleMtx(void) {
-    ctrdl_handleMtxLazyInit();
-    RecursiveLock_Lock(&g_Mtx);
+static void ctrdl_removeName(CTRDLHandle* handle) {
+    if (!g_NumNames)
+        return;
+
+    const size_t mask = g_NameCapacity - 1;
+    size_t hole = ctrdl_probeName(handle->pathHash, handle->canonPath);
+    if (g_Names[hole] != handle)
+        return;
+
+    // Shift back the entries which would become unreachable.
+    size_t next = (hole + 1) & mask;
+    while (g_Names[next]) {
+        const size_t home = g_Names[next]->pathHash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            g_Names[hole] = g_Names[next];
+            hole = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    g_Names[hole] = NULL;
+    --g_NumNames;
 }
 
-void ctrdl_releaseHandleMtx(void) {
-    ctrdl_handleMtxLazyInit();
-    RecursiveLock_Unlock(&g_Mtx);
+static void ctrdl_pushFreeHandle(CTRDLHandle* handle) {
+    memset(handle, 0, sizeof(*handle));
+    handle->next = g_FreeHandles;
+    g_FreeHandles = handle;
 }
 
+void ctrdl_acquireHandleMtx(void) { ctrdl_lockMutex(&g_Mtx); }
+void ctrdl_releaseHandleMtx(void) { ctrdl_unlockMutex(&g_Mtx); }
+
 CTRDLHandle* ctrdl_createHandle(const char* path, size_t flags) {
     CTRDLHandle* handle = NULL;
 
     size_t pathSize = 0;
     char* pathCopy = NULL;
     if (path) {
+        // The canonical path is stored right after the path.
         pathSize = strlen(path);
-        pathCopy = malloc(pathSize + 1);
+        pathCopy = malloc((pathSize + 1) * 2);
         if (!pathCopy) {
             ctrdl_setLastError(Err_NoMemory);
             return NULL;
@@ -47,27 +187,58 @@ CTRDLHandle* ctrdl_createHandle(const char* path, size_t flags) {
 
     ctrdl_acquireHandleMtx();
 
-    // Look for free handle.
-    for (size_t i = 0; i < CTRDL_MAX_HANDLES; ++i) {
-        CTRDLHandle* h = ctrdl_unsafeGetHandleByIndex(i);
-        if (!h->refc) {
-            handle = h;
-            break;
+    // Grab a free handle, allocating a new slab if needed.
+    if (!g_FreeHandles) {
+        CTRDLHandle* slab = calloc(HANDLE_SLAB_SIZE, sizeof(CTRDLHandle));
+        if (slab) {
+            for (size_t i = 0; i < HANDLE_SLAB_SIZE; ++i)
+                ctrdl_pushFreeHandle(&slab[i]);
         }
     }
 
+    handle = g_FreeHandles;
+    if (handle) {
+        g_FreeHandles = handle->next;
+        handle->next = NULL;
+    }
+
     // Initialize the handle if we have found one.
     if (handle) {
         if (pathCopy) {
             memcpy(pathCopy, path, pathSize);
             pathCopy[pathSize] = '\0';
+
+            handle->canonPath = &pathCopy[pathSize + 1];
+            ctrdl_canonicalizePath(pathCopy, handle->canonPath);
+            handle->pathHash = ctrdl_getELFGNUSymNameHash(handle->canonPath);
+
+            if (!ctrdl_addName(handle)) {
+                ctrdl_setLastError(Err_NoMemory);
+                ctrdl_pushFreeHandle(handle);
+                free(pathCopy);
+                handle = NULL;
+            }
         }
 
-        handle->path = pathCopy;
-        handle->flags = flags;
-        handle->refc = 1;
+        if (handle) {
+            handle->path = pathCopy;
+            handle->flags = flags;
+            handle->generation = ++g_Generation;
+            handle->refc = 1;
+
+            // Live handles are kept in creation order.
+            handle->prev = g_LastHandle;
+            if (g_LastHandle) {
+                g_LastHandle->next = handle;
+            } else {
+                g_FirstHandle = handle;
+            }
+
+            g_LastHandle = handle;
+        }
     } else {
-        ctrdl_setLastError(Err_HandleLimit);
+        ctrdl_setLastError(Err_NoMemory);
+        free(pathCopy);
     }
 
     ctrdl_releaseHandleMtx();
@@ -75,31 +246,59 @@ CTRDLHandle* ctrdl_createHandle(const char* path, size_t flags) {
 }
 
 void ctrdl_lockHandle(CTRDLHandle* handle) {
-    if (handle) {
-        ctrdl_acquireHandleMtx();
-        ++handle->refc;
-        ctrdl_releaseHandleMtx();
+    if (handle)
+        __atomic_add_fetch(&handle->refc, 1, __ATOMIC_RELAXED);
+}
+
+bool ctrdl_tryLockHandle(CTRDLHandle* handle) {
+    // Once the last reference is gone the object is being unloaded, don't revive it.
+    size_t refc = __atomic_load_n(&handle->refc, __ATOMIC_RELAXED);
+    while (refc) {
+        if (__atomic_compare_exchange_n(&handle->refc, &refc, refc + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
     }
+
+    return false;
 }
 
 bool ctrdl_unlockHandle(CTRDLHandle* handle) {
     bool ret = true;
 
     if (handle) {
-        ctrdl_acquireHandleMtx();
-
-        if (handle->refc)
-            --handle->refc;
+        size_t refc = __atomic_load_n(&handle->refc, __ATOMIC_RELAXED);
+        do {
+            if (!refc) {
+                ctrdl_setLastError(Err_InvalidParam);
+                return false;
+            }
+        } while (!__atomic_compare_exchange_n(&handle->refc, &refc, refc - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
 
-        if (!handle->refc) {
+        // Only the owner of the last reference unloads, under the mutex since the handle lists change.
+        if (refc == 1) {
+            ctrdl_acquireHandleMtx();
             ret = ctrdl_unloadObject(handle);
             if (ret) {
+                if (handle->canonPath)
+                    ctrdl_removeName(handle);
+
+                if (handle->prev) {
+                    handle->prev->next = handle->next;
+                } else {
+                    g_FirstHandle = handle->next;
+                }
+
+                if (handle->next) {
+                    handle->next->prev = handle->prev;
+                } else {
+                    g_LastHandle = handle->prev;
+                }
+
                 free(handle->path);
-                memset(handle, 0, sizeof(*handle));
+                ctrdl_pushFreeHandle(handle);
             }
-        }
 
-        ctrdl_releaseHandleMtx();
+            ctrdl_releaseHandleMtx();
+        }
     } else {
         ctrdl_setLastError(Err_InvalidParam);
         ret = false;
@@ -108,37 +307,130 @@ bool ctrdl_unlockHandle(CTRDLHandle* handle) {
     return ret;
 }
 
-CTRDLHandle* ctrdl_unsafeGetHandleByIndex(size_t index) {
-    if (index < CTRDL_MAX_HANDLES)
-        return &g_Handles[index];
+CTRDLHandle* ctrdl_unsafeGetFirstHandle(void) { return g_FirstHandle; }
 
-    return NULL;
+CTRDLHandle* ctrdl_unsafeFindHandleByName(const char* name) {
+    if (!g_NumNames)
+        return NULL;
+
+    // Short paths don't need an allocation.
+    char buffer[NAME_BUFFER_SIZE];
+    const size_t size = strlen(name) + 1;
+    char* canonPath = (size <= sizeof(buffer)) ? buffer : malloc(size);
+    if (!canonPath) {
+        ctrdl_setLastError(Err_NoMemory);
+        return NULL;
+    }
+
+    ctrdl_canonicalizePath(name, canonPath);
+    CTRDLHandle* found = g_Names[ctrdl_probeName(ctrdl_getELFGNUSymNameHash(canonPath), canonPath)];
+
+    if (canonPath != buffer)
+        free(canonPath);
+
+    return found;
 }
 
-CTRDLHandle* ctrdl_unsafeFindHandleByName(const char* name) {
-    CTRDLHandle* found = NULL;
+bool ctrdl_addHandleRange(CTRDLHandle* handle) {
+    ctrdl_acquireHandleMtx();
 
-    for (size_t i = 0; i < CTRDL_MAX_HANDLES; ++i) {
-        CTRDLHandle* h = ctrdl_unsafeGetHandleByIndex(i);
-        if (h->refc && h->path && strstr(h->path, name)) {
-            found = h;
-            break;
+    CTRDLRangeArray* ranges = g_Ranges;
+    if (!ranges || (g_NumRanges >= ranges->capacity)) {
+        const size_t capacity = ranges ? (ranges->capacity * 2) : MIN_RANGE_CAPACITY;
+        ranges = malloc(sizeof(CTRDLRangeArray) + (capacity * sizeof(CTRDLRange)));
+        if (!ranges) {
+            ctrdl_setLastError(Err_NoMemory);
+            ctrdl_releaseHandleMtx();
+            return false;
         }
+
+        ranges->retired = g_Ranges;
+        ranges->capacity = capacity;
+        if (g_Ranges)
+            memcpy(ranges->ranges, g_Ranges->ranges, g_NumRanges * sizeof(CTRDLRange));
     }
 
-    return found;
+    size_t index = g_NumRanges;
+    while ((index > 0) && (ranges->ranges[index - 1].base > handle->base))
+        --index;
+
+    ctrdl_beginRangeWrite();
+
+    for (size_t i = g_NumRanges; i > index; --i)
+        ctrdl_storeRange(&ranges->ranges[i], &ranges->ranges[i - 1]);
+
+    const CTRDLRange range = { handle->base, handle->base + handle->size, handle };
+    ctrdl_storeRange(&ranges->ranges[index], &range);
+    __atomic_store_n(&g_Ranges, ranges, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_NumRanges, g_NumRanges + 1, __ATOMIC_RELAXED);
+
+    ctrdl_endRangeWrite();
+    ctrdl_releaseHandleMtx();
+    return true;
 }
 
-CTRDLHandle* ctrdl_unsafeFindHandleByAddr(u32 addr) {
-    CTRDLHandle* found = NULL;
+void ctrdl_removeHandleRange(CTRDLHandle* handle) {
+    ctrdl_acquireHandleMtx();
 
-    for (size_t i = 0; i < CTRDL_MAX_HANDLES; ++i) {
-        CTRDLHandle* h = ctrdl_unsafeGetHandleByIndex(i);
-        if (h->refc && (addr >= h->base) && (addr <= (h->base + h->size))) {
-            found = h;
-            break;
+    size_t index = 0;
+    while ((index < g_NumRanges) && (g_Ranges->ranges[index].handle != handle))
+        ++index;
+
+    if (index < g_NumRanges) {
+        ctrdl_beginRangeWrite();
+
+        for (size_t i = index + 1; i < g_NumRanges; ++i)
+            ctrdl_storeRange(&g_Ranges->ranges[i - 1], &g_Ranges->ranges[i]);
+
+        __atomic_store_n(&g_NumRanges, g_NumRanges - 1, __ATOMIC_RELAXED);
+
+        ctrdl_endRangeWrite();
+    }
+
+    ctrdl_releaseHandleMtx();
+}
+
+static CTRDLHandle* ctrdl_searchRanges(u32 addr) {
+    // Find the last range starting at or before the address.
+    const CTRDLRangeArray* ranges = __atomic_load_n(&g_Ranges, __ATOMIC_RELAXED);
+    size_t low = 0;
+    size_t high = ranges ? __atomic_load_n(&g_NumRanges, __ATOMIC_RELAXED) : 0;
+    if (ranges && (high > ranges->capacity))
+        high = ranges->capacity;
+
+    while (low < high) {
+        const size_t mid = low + ((high - low) / 2);
+        if (__atomic_load_n(&ranges->ranges[mid].base, __ATOMIC_RELAXED) <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
     }
 
+    if (low && (addr < __atomic_load_n(&ranges->ranges[low - 1].end, __ATOMIC_RELAXED)))
+        return __atomic_load_n(&ranges->ranges[low - 1].handle, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+CTRDLHandle* ctrdl_findHandleByAddr(u32 addr) {
+    for (size_t i = 0; i < MAX_RANGE_READ_ATTEMPTS; ++i) {
+        // Don't wait on writers, a preempted one would never finish on a lower priority thread.
+        const u32 seq = __atomic_load_n(&g_RangeSeq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        CTRDLHandle* found = ctrdl_searchRanges(addr);
+
+        // Retry if the ranges changed meanwhile.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&g_RangeSeq, __ATOMIC_RELAXED) == seq)
+            return found;
+    }
+
+    // Writers hold the mutex, taking it blocks until they are done.
+    ctrdl_acquireHandleMtx();
+    CTRDLHandle* found = ctrdl_searchRanges(addr);
+    ctrdl_releaseHandleMtx();
     return found;
-}
\ No newline at end of file
+}
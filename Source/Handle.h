@@ -5,38 +5,94 @@
 
 #include "ELFUtil.h"
 
-#define CTRDL_MAX_HANDLES 16
-#define CTRDL_MAX_DEPS 16
-
 typedef void(*InitFiniFn)();
 
+// Either resolver kind, or none.
+typedef struct {
+    CTRDLResolverFn fn;           // Called for each symbol.
+    CTRDLBatchResolverFn batchFn; // Called once per object with all the imports.
+    void* userData;               // Resolver user data.
+} CTRDLResolver;
+
 typedef struct {
-    char* path;                 // Object path.
-    u32 base;                   // Mirror address of mapped region.
-    u32 origin;                 // Original address of mapped region.
-    size_t size;                // Size of mapped region.
-    size_t refc;                // Object refcount.
-    size_t flags;               // Object flags.
-    void* deps[CTRDL_MAX_DEPS]; // Object dependencies.
-    InitFiniFn* finiArray;      // Fini array address.
-    size_t numOfFiniEntries;    // Number of fini functions.
-    size_t numSymBuckets;       // Number of symbol buckets;
-    Elf32_Word* symBuckets;     // Symbol buckets.
-    size_t numSymChains;        // Number of symbol chains (entries).
-    Elf32_Word* symChains;      // Symbol chains.
-    Elf32_Sym* symEntries;      // Symbol entries.
-    char* stringTable;          // String table.
+    u32 addr;             // Symbol address, relative to the base.
+    u32 size;             // Symbol size.
+    const Elf32_Sym* sym; // Symbol entry (mapped).
+} CTRDLAddrEntry;
+
+typedef struct {
+    u32 origin;  // Backing allocation.
+    u32 offset;  // Offset in the image.
+    size_t size; // Size.
+} CTRDLPiece;
+
+typedef struct CTRDLHandle {
+    char* path;                   // Object path.
+    char* canonPath;              // Canonical path, used for lookups by name.
+    Elf32_Word pathHash;          // Hash of the canonical path.
+    u32 base;                     // Mirror address of mapped region.
+    u32 origin;                   // Original address of mapped region.
+    CTRDLPiece* pieces;           // Backing pieces when the image is scattered, origin is 0 then.
+    size_t numPieces;             // Number of backing pieces.
+    bool inPlace;                 // Whether origin is a caller buffer, which isn't freed.
+    size_t size;                  // Size of mapped region.
+    size_t savedSize;             // Bytes saved over padding each segment to its alignment.
+    size_t refc;                  // Object refcount (atomic).
+    size_t flags;                 // Object flags.
+    u32 generation;               // Unique among the objects which used this handle.
+    struct CTRDLHandle** deps;    // Object dependencies.
+    size_t numDeps;               // Number of dependencies.
+    struct CTRDLHandle** scope;   // Lookup scope, the object and its dependencies breadth first.
+    size_t scopeSize;             // Number of objects in the lookup scope.
+    bool scopeNeedsSysVHash;      // Whether some object in the scope has no GNU hash table.
+    InitFiniFn* finiArray;        // Fini array address.
+    size_t numOfFiniEntries;      // Number of fini functions.
+    bool hasGNUHash;              // Whether symbols are hashed with the GNU hash.
+    Elf32_Word symOffset;         // First hashed symbol (GNU hash).
+    Elf32_Word bloomSize;         // Number of bloom filter words (GNU hash).
+    Elf32_Word bloomShift;        // Bloom filter shift (GNU hash).
+    const Elf32_Word* bloom;      // Bloom filter (GNU hash, mapped).
+    size_t numSymBuckets;         // Number of symbol buckets;
+    const Elf32_Word* symBuckets; // Symbol buckets (mapped).
+    size_t numSymChains;          // Number of symbol chains (entries).
+    const Elf32_Word* symChains;  // Symbol chains (mapped).
+    const Elf32_Sym* symEntries;  // Symbol entries (mapped).
+    const char* stringTable;      // String table (mapped).
+    CTRDLStreamStats readStats;   // Stream statistics for the load.
+    size_t symCacheHits;          // Relocation symbols served by the load cache.
+    size_t symCacheMisses;        // Relocation symbols resolved while loading.
+    CTRDLResolverFn resolver;     // Symbol resolver, kept for lazy binding.
+    void* resolverUserData;       // Symbol resolver user data.
+    u32 pltGot;                   // GOT offset (lazy binding).
+    const void* jmpRelEntries;    // PLT relocations (lazy binding, mapped).
+    size_t numJmpRelEntries;      // Number of PLT relocations.
+    bool jmpRelIsRela;            // Whether PLT relocations are Elf32_Rela.
+    u32* lazyBound;               // Bitmap of bound PLT relocations, NULL if bound at load.
+    size_t numLazySlots;          // Number of slots left for lazy binding.
+    size_t numBoundSlots;         // Number of lazy slots bound so far.
+    CTRDLAddrEntry* addrIndex;    // Symbols sorted by address, built on first lookup.
+    size_t numAddrEntries;        // Number of entries in the address index.
+    struct CTRDLHandle* prev;     // Previous live handle.
+    struct CTRDLHandle* next;     // Next live handle, or next free handle.
 } CTRDLHandle;
 
 void ctrdl_acquireHandleMtx(void);
 void ctrdl_releaseHandleMtx(void);
 
 CTRDLHandle* ctrdl_createHandle(const char* path, size_t flags);
+// Refcounts are atomic, locking only requires an existing reference.
+// Handles found without one (by name or address) must use ctrdl_tryLockHandle.
 void ctrdl_lockHandle(CTRDLHandle* handle);
+bool ctrdl_tryLockHandle(CTRDLHandle* handle);
 bool ctrdl_unlockHandle(CTRDLHandle* handle);
 
-CTRDLHandle* ctrdl_unsafeGetHandleByIndex(size_t index);
+// Live handles in creation order, follow next to iterate.
+CTRDLHandle* ctrdl_unsafeGetFirstHandle(void);
 CTRDLHandle* ctrdl_unsafeFindHandleByName(const char* name);
-CTRDLHandle* ctrdl_unsafeFindHandleByAddr(u32 addr);
+
+// Address ranges of mapped objects, lookups don't need the handle mutex.
+bool ctrdl_addHandleRange(CTRDLHandle* handle);
+void ctrdl_removeHandleRange(CTRDLHandle* handle);
+CTRDLHandle* ctrdl_findHandleByAddr(u32 addr);
 
 #endif /* _CTRDL_HANDLE_H */
\ No newline at end of file
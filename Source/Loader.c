@@ -1,38 +1,37 @@
-#include "CTRL/Memory.h"
-
 #include "Loader.h"
+#include "AddrSpace.h"
 #include "Handle.h"
 #include "ELFUtil.h"
+#include "GlobalSymbols.h"
+#include "Platform.h"
 #include "Relocs.h"
+#include "Symbol.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-#define CODE_BASE 0x100000
-#define CODE_SIZE 0x3F00000
-
 typedef struct {
     CTRDLHandle* handle;
     CTRDLStream* stream;
     CTRDLElf elf;
-    CTRDLResolverFn resolver;
-    void* resolverUserData;
+    CTRDLResolver resolver;
+    void* image;
 } LdrData;
 
-static MemPerm ctrdl_wrapPerms(Elf32_Word flags) {
+static u32 ctrdl_wrapPerms(Elf32_Word flags) {
     switch (flags) {
         case PF_R:
-            return MEMPERM_READ;
+            return CTRDL_PERM_R;
         case PF_W:
-            return MEMPERM_WRITE;
+            return CTRDL_PERM_W;
         case PF_X:
-            return MEMPERM_EXECUTE;
+            return CTRDL_PERM_X;
         case PF_R | PF_W:
-            return MEMPERM_READWRITE;
+            return CTRDL_PERM_R | CTRDL_PERM_W;
         case PF_R | PF_X:
-            return MEMPERM_READEXECUTE;
+            return CTRDL_PERM_R | CTRDL_PERM_X;
         default:
-            return (MemPerm)0;
+            return 0;
     }
 }
 
@@ -63,46 +62,152 @@ static char* ctrdl_getDepPath(const char* basePath, const char* name) {
 
 static bool ctrdl_loadDeps(LdrData* ldrData) {
     const size_t depCount = ctrdl_getELFNumDynEntriesWithTag(&ldrData->elf, DT_NEEDED);
-    if (depCount > CTRDL_MAX_DEPS) {
-        ctrdl_setLastError(Err_DepsLimit);
+    if (!depCount)
+        return true;
+
+    Elf32_Dyn* depEntries = malloc(depCount * sizeof(Elf32_Dyn));
+    ldrData->handle->deps = calloc(depCount, sizeof(CTRDLHandle*));
+    if (!depEntries || !ldrData->handle->deps) {
+        ctrdl_setLastError(Err_NoMemory);
+        free(depEntries);
         return false;
     }
 
-    Elf32_Dyn depEntries[CTRDL_MAX_DEPS];
-    const size_t actualDepCount = ctrdl_getELFDynEntriesWithTag(&ldrData->elf, DT_NEEDED, depEntries, CTRDL_MAX_DEPS);
+    const size_t actualDepCount = ctrdl_getELFDynEntriesWithTag(&ldrData->elf, DT_NEEDED, depEntries, depCount);
     if (actualDepCount != depCount) {
         ctrdl_setLastError(Err_DepFailed);
+        free(depEntries);
         return false;
     }
 
     for (size_t i = 0; i < depCount; ++i) {
         char* depPath = ctrdl_getDepPath(ldrData->handle->path, ldrData->elf.stringTable + depEntries[i].d_un.d_ptr);
-        void* depHandle = ctrdlOpen(depPath, RTLD_NOW | RTLD_LOCAL, ldrData->resolver, ldrData->resolverUserData);
+        const int mode = (ldrData->handle->flags & RTLD_LAZY) ? RTLD_LAZY : RTLD_NOW;
+        const CTRDLResolver* resolver = &ldrData->resolver;
+        void* depHandle = resolver->batchFn ? ctrdlOpenBatch(depPath, mode | RTLD_LOCAL, resolver->batchFn, resolver->userData)
+                                            : ctrdlOpen(depPath, mode | RTLD_LOCAL, resolver->fn, resolver->userData);
         free(depPath);
 
         if (!depHandle) {
             ctrdl_setLastError(Err_DepFailed);
+            free(depEntries);
             return false;
         }
 
-        ldrData->handle->deps[i] = depHandle;
+        ldrData->handle->deps[ldrData->handle->numDeps++] = depHandle;
     }
 
+    free(depEntries);
     return true;
 }
 
-static bool ctrdl_mapObject(LdrData* ldrData) {
-    CTRDLHandle* handle = ldrData->handle;
+static void ctrdl_clearBss(u32 image, const Elf32_Phdr* segments, size_t numSegments) {
+    for (size_t i = 0; i < numSegments; ++i) {
+        const Elf32_Phdr* segment = &segments[i];
+        if (segment->p_memsz > segment->p_filesz)
+            memset((void*)(image + segment->p_vaddr + segment->p_filesz), 0, segment->p_memsz - segment->p_filesz);
+    }
+}
 
-    // Load dependencies.
-    if (!ctrdl_loadDeps(ldrData)) {
-        // References may be resolved by the user.
-        if (!ldrData->resolver) {
-            ctrdl_unloadObject(handle);
+// A caller image can be mirrored as is if it covers the whole image and segments are at their address.
+static bool ctrdl_checkInPlace(const LdrData* ldrData, const Elf32_Phdr* segments, size_t numSegments) {
+    if (((u32)ldrData->image & (CTRDL_PAGE_SIZE - 1)) || (ldrData->stream->size < ldrData->handle->size)) {
+        ctrdl_setLastError(Err_InvalidParam);
+        return false;
+    }
+
+    for (size_t i = 0; i < numSegments; ++i) {
+        if (segments[i].p_offset != segments[i].p_vaddr) {
+            ctrdl_setLastError(Err_InvalidObject);
             return false;
         }
     }
 
+    return true;
+}
+
+static bool ctrdl_unmirrorPieces(CTRDLHandle* handle, u32 base, size_t count) {
+    bool ret = true;
+    for (size_t i = 0; i < count; ++i) {
+        const CTRDLPiece* piece = &handle->pieces[i];
+        if (!ctrdl_unmirror(base + piece->offset, piece->origin, piece->size))
+            ret = false;
+    }
+
+    return ret;
+}
+
+static void ctrdl_freePieces(CTRDLHandle* handle) {
+    for (size_t i = 0; i < handle->numPieces; ++i)
+        ctrdl_freeBacking(handle->pieces[i].origin, handle->pieces[i].size);
+
+    free(handle->pieces);
+    handle->pieces = NULL;
+    handle->numPieces = 0;
+}
+
+// Backs the pages covered by segments with separate runs, and mirrors them right away
+// so that the image can be read and parsed through a contiguous view.
+static bool ctrdl_scatterImage(CTRDLHandle* handle, const Elf32_Phdr* segments, size_t numSegments) {
+    handle->pieces = malloc(((handle->size / CTRDL_SCATTER_RUN_SIZE) + numSegments) * sizeof(CTRDLPiece));
+    if (!handle->pieces) {
+        ctrdl_setLastError(Err_NoMemory);
+        return false;
+    }
+
+    u32 end = 0;
+    for (size_t i = 0; i < numSegments; ++i) {
+        const Elf32_Phdr* segment = &segments[i];
+        if (i && (segment->p_vaddr < segments[i - 1].p_vaddr)) {
+            ctrdl_setLastError(Err_InvalidObject);
+            return false;
+        }
+
+        u32 start = segment->p_vaddr & ~(CTRDL_PAGE_SIZE - 1);
+        const u32 segmentEnd = ctrdl_alignSize(segment->p_vaddr + segment->p_memsz, CTRDL_PAGE_SIZE);
+        if (start < end)
+            start = end;
+
+        while (start < segmentEnd) {
+            const size_t size = ((segmentEnd - start) > CTRDL_SCATTER_RUN_SIZE) ? CTRDL_SCATTER_RUN_SIZE : (segmentEnd - start);
+            const u32 origin = ctrdl_allocBacking(size);
+            if (!origin) {
+                ctrdl_setLastError(Err_NoMemory);
+                return false;
+            }
+
+            CTRDLPiece* piece = &handle->pieces[handle->numPieces++];
+            piece->origin = origin;
+            piece->offset = start;
+            piece->size = size;
+            start += size;
+        }
+
+        if (segmentEnd > end)
+            end = segmentEnd;
+    }
+
+    // Dependencies aren't known yet, no placement hint.
+    u32 base;
+    if (!ctrdl_allocAddrSpace(handle->size, 0, &base))
+        return false;
+
+    for (size_t i = 0; i < handle->numPieces; ++i) {
+        const CTRDLPiece* piece = &handle->pieces[i];
+        if (!ctrdl_mirror(base + piece->offset, piece->origin, piece->size)) {
+            ctrdl_unmirrorPieces(handle, base, i);
+            ctrdl_freeAddrSpace(base, handle->size);
+            return false;
+        }
+    }
+
+    handle->base = base;
+    return true;
+}
+
+static bool ctrdl_mapObject(LdrData* ldrData) {
+    CTRDLHandle* handle = ldrData->handle;
+
     // Calculate allocation space for load segments.
     const size_t numSegments = ctrdl_getELFNumSegmentsByType(&ldrData->elf, PT_LOAD);
     if (!numSegments) {
@@ -126,6 +231,7 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
         return false;
     }
 
+    size_t alignedSize = 0;
     for (size_t i = 0; i < numSegments; ++i) {
         const Elf32_Phdr* segment = &loadSegments[i];
 
@@ -136,35 +242,75 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
             return false;
         }
 
+        // Segments are placed at their address, the image only has to span up to the last one.
+        const u32 segmentEnd = segment->p_vaddr + segment->p_memsz;
+        if (segmentEnd < segment->p_vaddr) {
+            ctrdl_setLastError(Err_InvalidObject);
+            ctrdl_unloadObject(handle);
+            free(loadSegments);
+            return false;
+        }
+
+        if (segmentEnd > handle->size)
+            handle->size = segmentEnd;
+
+        // Kept to report what padding each segment to its alignment would have cost.
         if (segment->p_align > 1) {
-            handle->size += ctrlAlignSize(segment->p_memsz, segment->p_align);
+            alignedSize += ctrdl_alignSize(segment->p_memsz, segment->p_align);
         } else {
-            handle->size += segment->p_memsz;
+            alignedSize += segment->p_memsz;
         }
     }
 
-    handle->size = ctrlAlignSize(handle->size, CTRL_PAGE_SIZE);
-    
-    // Allocate and map segments.
-    handle->origin = (u32)aligned_alloc(CTRL_PAGE_SIZE, handle->size);
-    if (!handle->origin) {
-        ctrdl_setLastError(Err_NoMemory);
-        ctrdl_unloadObject(handle);
-        free(loadSegments);
-        return false;
+    handle->size = ctrdl_alignSize(handle->size, CTRDL_PAGE_SIZE);
+    alignedSize = ctrdl_alignSize(alignedSize, CTRDL_PAGE_SIZE);
+    handle->savedSize = (alignedSize > handle->size) ? (alignedSize - handle->size) : 0;
+
+    if (ldrData->image) {
+        // Mapped without copying, the buffer stays owned by the caller.
+        if (!ctrdl_checkInPlace(ldrData, loadSegments, numSegments)) {
+            ctrdl_unloadObject(handle);
+            free(loadSegments);
+            return false;
+        }
+
+        handle->origin = (u32)ldrData->image;
+        handle->inPlace = true;
+    } else {
+        // Allocate and map segments, a fragmented heap may only fit the image in pieces.
+        handle->origin = ctrdl_allocBacking(handle->size);
+        if (!handle->origin && !ctrdl_scatterImage(handle, loadSegments, numSegments)) {
+            ctrdl_unloadObject(handle);
+            free(loadSegments);
+            return false;
+        }
     }
 
-    for (size_t i = 0; i < numSegments; ++i) {
-        const Elf32_Phdr* segment = &loadSegments[i];
+    const u32 image = handle->origin ? handle->origin : handle->base;
 
-        if (!ldrData->stream->seek(ldrData->stream, segment->p_offset)) {
-            ctrdl_setLastError(Err_ReadFailed);
+    if (!handle->inPlace) {
+        CTRDLReadRange* ranges = malloc(numSegments * sizeof(CTRDLReadRange));
+        if (!ranges) {
+            ctrdl_setLastError(Err_NoMemory);
             ctrdl_unloadObject(handle);
             free(loadSegments);
             return false;
         }
 
-        if (!ldrData->stream->read(ldrData->stream, (void*)(handle->origin + segment->p_vaddr), segment->p_filesz)) {
+        for (size_t i = 0; i < numSegments; ++i) {
+            const Elf32_Phdr* segment = &loadSegments[i];
+            ranges[i].offset = segment->p_offset;
+            ranges[i].size = segment->p_filesz;
+            ranges[i].out = (void*)(image + segment->p_vaddr);
+        }
+
+        // The backing memory isn't cleared, only the BSS has to be.
+        ctrdl_clearBss(image, loadSegments, numSegments);
+
+        const bool segmentsRead = ctrdl_streamReadRanges(ldrData->stream, ranges, numSegments);
+        free(ranges);
+
+        if (!segmentsRead) {
             ctrdl_setLastError(Err_ReadFailed);
             ctrdl_unloadObject(handle);
             free(loadSegments);
@@ -172,54 +318,82 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
         }
     }
 
-    size_t processedSize = 0;
-    MemInfo memInfo;
-    memInfo.base_addr = CODE_BASE;
-    while (true) {
-        if (R_FAILED(ctrlQueryRegion(memInfo.base_addr + processedSize, &memInfo))) {
-            ctrdl_setLastError(Err_MapFailed);
+    // Symbol tables are part of the loaded segments.
+    if (!ctrdl_resolveELFTables(&ldrData->elf, image, handle->size)) {
+        ctrdl_setLastError(Err_InvalidObject);
+        ctrdl_unloadObject(handle);
+        free(loadSegments);
+        return false;
+    }
+
+    // Load dependencies.
+    if (!ctrdl_loadDeps(ldrData)) {
+        // References may be resolved by the user.
+        if (!ldrData->resolver.fn && !ldrData->resolver.batchFn) {
             ctrdl_unloadObject(handle);
             free(loadSegments);
             return false;
         }
+    }
 
-        if (memInfo.base_addr >= (CODE_BASE + CODE_SIZE)) {
-            ctrdl_setLastError(Err_NoMemory);
+    if (!ctrdl_buildLookupScope(handle)) {
+        ctrdl_unloadObject(handle);
+        free(loadSegments);
+        return false;
+    }
+
+    // Scattered images are mirrored already.
+    if (!handle->base) {
+        // Keep objects next to their last dependency.
+        u32 hint = 0;
+        if (handle->numDeps) {
+            const CTRDLHandle* dep = handle->deps[handle->numDeps - 1];
+            hint = dep->base + dep->size;
+        }
+
+        u32 base;
+        if (!ctrdl_allocAddrSpace(handle->size, hint, &base)) {
             ctrdl_unloadObject(handle);
             free(loadSegments);
             return false;
         }
 
-        if ((memInfo.state == MEMSTATE_FREE) && (memInfo.size >= handle->size))
-            break;
+        if (!ctrdl_mirror(base, handle->origin, handle->size)) {
+            ctrdl_freeAddrSpace(base, handle->size);
+            ctrdl_unloadObject(handle);
+            free(loadSegments);
+            return false;
+        }
 
-        processedSize += memInfo.size;
-    };
+        handle->base = base;
+    }
 
-    handle->base = memInfo.base_addr;
-    if (R_FAILED(ctrlMirror(handle->base, handle->origin, handle->size))) {
-        ctrdl_setLastError(Err_MapFailed);
+    if (!ctrdl_addHandleRange(handle)) {
         ctrdl_unloadObject(handle);
         free(loadSegments);
         return false;
     }
 
     // Apply relocations.
-    if (!ctrdl_handleRelocs(handle, &ldrData->elf, ldrData->resolver, ldrData->resolverUserData)) {
-        ctrdl_setLastError(Err_RelocFailed);
+    if (!ctrdl_handleRelocs(handle, &ldrData->elf, ldrData->stream, &ldrData->resolver)) {
         ctrdl_unloadObject(handle);
         free(loadSegments);
         return false;
     }
 
+    // In place, the BSS may still hold file data such as relocation tables outside of the segments.
+    if (handle->inPlace)
+        ctrdl_clearBss(handle->origin, loadSegments, numSegments);
+
     // Set correct permissions.
     for (size_t i = 0; i < numSegments; ++i) {
         const Elf32_Phdr* segment = &loadSegments[i];
-        const u32 base = handle->base + segment->p_vaddr;
-        const size_t alignedSize = ctrlAlignSize(segment->p_memsz, segment->p_align);
-        const MemPerm perms = ctrdl_wrapPerms(segment->p_flags);
+        // Pages covered by the segment, its alignment may go past the end of the image.
+        const u32 base = handle->base + (segment->p_vaddr & ~(CTRDL_PAGE_SIZE - 1));
+        const size_t alignedSize = ctrdl_alignSize(handle->base + segment->p_vaddr + segment->p_memsz, CTRDL_PAGE_SIZE) - base;
+        const u32 perms = ctrdl_wrapPerms(segment->p_flags);
 
-        if (R_FAILED(ctrlChangePerms(base, alignedSize, perms))) {
+        if (!ctrdl_changePerms(base, alignedSize, perms)) {
             ctrdl_setLastError(Err_MapFailed);
             ctrdl_unloadObject(handle);
             free(loadSegments);
@@ -227,7 +401,7 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
         }
     }
 
-    if (R_FAILED(ctrlFlushCache(CTRL_ICACHE | CTRL_DCACHE))) {
+    if (!ctrdl_flushCache(handle->base, handle->size)) {
         ctrdl_setLastError(Err_MapFailed);
         ctrdl_unloadObject(handle);
         free(loadSegments);
@@ -236,6 +410,29 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
 
     free(loadSegments);
 
+    // Refer to the tables through the mirror from now on, initializers may already look symbols up.
+    ctrdl_resolveELFTables(&ldrData->elf, handle->base, handle->size);
+    handle->hasGNUHash = ldrData->elf.hasGNUHash;
+    handle->symOffset = ldrData->elf.symOffset;
+    handle->bloomSize = ldrData->elf.bloomSize;
+    handle->bloomShift = ldrData->elf.bloomShift;
+    handle->bloom = ldrData->elf.bloom;
+    handle->numSymBuckets = ldrData->elf.numOfSymBuckets;
+    handle->symBuckets = ldrData->elf.symBuckets;
+    handle->numSymChains = ldrData->elf.numOfSymChains;
+    handle->symChains = ldrData->elf.symChains;
+    handle->stringTable = ldrData->elf.stringTable;
+
+    if (handle->lazyBound) {
+        handle->pltGot = ldrData->elf.pltGot;
+        handle->jmpRelEntries = ldrData->elf.jmpRelTable.entries;
+        handle->numJmpRelEntries = ldrData->elf.jmpRelTable.count;
+        handle->jmpRelIsRela = ldrData->elf.jmpRelTable.isRela;
+    }
+
+    // Published last, lock free readers check it before using the other tables.
+    __atomic_store_n(&handle->symEntries, ldrData->elf.symEntries, __ATOMIC_RELEASE);
+
     // Run initializers.
     Elf32_Dyn initEntry;
     const bool hasInitArr = ctrdl_getELFDynEntryWithTag(&ldrData->elf, DT_INIT_ARRAY, &initEntry);
@@ -262,20 +459,10 @@ static bool ctrdl_mapObject(LdrData* ldrData) {
         handle->numOfFiniEntries = finiEntrySize.d_un.d_val / sizeof(Elf32_Addr);
     }
 
-    handle->numSymBuckets = ldrData->elf.numOfSymBuckets;
-    handle->symBuckets = ldrData->elf.symBuckets;
-    handle->numSymChains = ldrData->elf.numOfSymChains;
-    handle->symChains = ldrData->elf.symChains;
-    handle->symEntries = ldrData->elf.symEntries;
-    handle->stringTable = ldrData->elf.stringTable;
-    ldrData->elf.symBuckets = NULL;
-    ldrData->elf.symChains = NULL;
-    ldrData->elf.symEntries = NULL;
-    ldrData->elf.stringTable = NULL;
     return true;
 }
 
-CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream, CTRDLResolverFn resolver, void* resolverUserData) {
+CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream, const CTRDLResolver* resolver, void* image) {
     LdrData ldrData;
     ldrData.handle = ctrdl_createHandle(name, flags);
     if (!ldrData.handle)
@@ -287,9 +474,11 @@ CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream,
     }
 
     ldrData.stream = stream;
-    ldrData.resolver = resolver;
-    ldrData.resolverUserData = resolverUserData;
-    if (!ctrdl_mapObject(&ldrData)) {
+    ldrData.resolver = *resolver;
+    ldrData.image = image;
+    if (ctrdl_mapObject(&ldrData) && (!(flags & RTLD_GLOBAL) || ctrdl_addGlobalSymbols(ldrData.handle))) {
+        memcpy(&ldrData.handle->readStats, &stream->stats, sizeof(CTRDLStreamStats));
+    } else {
         ctrdl_unlockHandle(ldrData.handle);
         ldrData.handle = NULL;
     }
@@ -299,6 +488,8 @@ CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream,
 }
 
 bool ctrdl_unloadObject(CTRDLHandle* handle) {
+    ctrdl_removeGlobalSymbols(handle);
+
     // Run finalizers.
     if (handle->finiArray) {
         for (size_t i = 0; i < handle->numOfFiniEntries; ++i)
@@ -307,30 +498,53 @@ bool ctrdl_unloadObject(CTRDLHandle* handle) {
 
     // Unmap segments.
     if (handle->base) {
-        if (R_FAILED(ctrlUnmirror(handle->base, handle->origin, handle->size))) {
+        ctrdl_removeHandleRange(handle);
+
+        const bool unmirrored = handle->pieces ? ctrdl_unmirrorPieces(handle, handle->base, handle->numPieces)
+                                               : ctrdl_unmirror(handle->base, handle->origin, handle->size);
+        if (!unmirrored) {
             ctrdl_setLastError(Err_FreeFailed);
             return false;
         }
 
+        ctrdl_freeAddrSpace(handle->base, handle->size);
         handle->base = 0;
     }
 
     if (handle->origin) {
-        free((void*)handle->origin);
+        if (!handle->inPlace)
+            ctrdl_freeBacking(handle->origin, handle->size);
+
         handle->origin = 0;
-        handle->size = 0;
+        handle->inPlace = false;
     }
 
-    // Unload dependencies.
-    for (size_t i = 0; i < CTRDL_MAX_DEPS; ++i) {
-        CTRDLHandle* dep = (CTRDLHandle*)handle->deps[i];
-        if (dep)
-            ctrdl_unlockHandle(dep);
-    }
+    ctrdl_freePieces(handle);
+    handle->size = 0;
 
-    free(handle->symBuckets);
-    free(handle->symChains);
-    free(handle->symEntries);
-    free(handle->stringTable);
+    // The scope refers to dependencies.
+    free(handle->scope);
+    handle->scope = NULL;
+    handle->scopeSize = 0;
+
+    // Unload dependencies.
+    for (size_t i = 0; i < handle->numDeps; ++i)
+        ctrdl_unlockHandle(handle->deps[i]);
+
+    free(handle->deps);
+    handle->deps = NULL;
+    handle->numDeps = 0;
+
+    free(handle->lazyBound);
+    handle->lazyBound = NULL;
+    free(handle->addrIndex);
+    handle->addrIndex = NULL;
+    handle->numAddrEntries = 0;
+    handle->jmpRelEntries = NULL;
+    handle->bloom = NULL;
+    handle->symBuckets = NULL;
+    handle->symChains = NULL;
+    handle->symEntries = NULL;
+    handle->stringTable = NULL;
     return true;
 }
\ No newline at end of file
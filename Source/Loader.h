@@ -4,7 +4,13 @@
 #include "Handle.h"
 #include "Stream.h"
 
-CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream, CTRDLResolverFn resolver, void* resolverUserData);
+// Images which can't get a contiguous block are backed by separate runs of at most this size.
+#ifndef CTRDL_SCATTER_RUN_SIZE
+#define CTRDL_SCATTER_RUN_SIZE 0x10000
+#endif
+
+// The image, if any, is a page aligned buffer laid out like the object in memory, which is mapped in place.
+CTRDLHandle* ctrdl_loadObject(const char* name, int flags, CTRDLStream* stream, const CTRDLResolver* resolver, void* image);
 bool ctrdl_unloadObject(CTRDLHandle* handle);
 
 #endif /* _CTRDL_LOADER_H */
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef _CTRDL_PLATFORM_H
+#define _CTRDL_PLATFORM_H
+
+#include <dlfcn.h>
+
+#if defined(__3DS__)
+#include "CTRL/Types.h"
+#define CTRDL_INLINE CTRL_INLINE
+#else
+#include <pthread.h>
+#define CTRDL_INLINE inline __attribute__((always_inline))
+#endif
+
+#define CTRDL_PAGE_SIZE 0x1000
+
+// Permissions, values match both MemPerm and PROT_*.
+#define CTRDL_PERM_R 0x1
+#define CTRDL_PERM_W 0x2
+#define CTRDL_PERM_X 0x4
+
+typedef struct {
+    u32 base;    // Region base address.
+    size_t size; // Region size.
+    bool free;   // Whether the region is unmapped.
+} CTRDLRegion;
+
+#if defined(__3DS__)
+typedef struct {
+    u8 initialized;
+    RecursiveLock lock;
+} CTRDLMutex;
+
+#define CTRDL_MUTEX_INIT {}
+#else
+typedef pthread_mutex_t CTRDLMutex;
+
+#define CTRDL_MUTEX_INIT PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#endif
+
+CTRDL_INLINE size_t ctrdl_alignSize(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void ctrdl_lockMutex(CTRDLMutex* mtx);
+void ctrdl_unlockMutex(CTRDLMutex* mtx);
+
+bool ctrdl_getMirrorSpace(u32* base, size_t* size);
+bool ctrdl_queryRegion(u32 addr, CTRDLRegion* out);
+
+u32 ctrdl_allocBacking(size_t size);
+void ctrdl_freeBacking(u32 addr, size_t size);
+
+#if !defined(__3DS__)
+// Test only, stands in for a fragmented heap by failing larger allocations.
+void ctrdl_setMaxBacking(size_t size);
+#endif
+
+// Sets the last error on failure.
+bool ctrdl_mirror(u32 dst, u32 src, size_t size);
+bool ctrdl_unmirror(u32 dst, u32 src, size_t size);
+bool ctrdl_changePerms(u32 addr, size_t size, u32 perms);
+bool ctrdl_flushCache(u32 addr, size_t size);
+
+#endif /* _CTRDL_PLATFORM_H */
@@ -0,0 +1,67 @@
+#include "CTRL/Memory.h"
+
+#include "../Error.h"
+#include "../Platform.h"
+
+#include <stdlib.h>
+
+#define CODE_BASE 0x100000
+#define CODE_SIZE 0x3F00000
+
+static void ctrdl_mutexLazyInit(CTRDLMutex* mtx) {
+    if (!__ldrexb(&mtx->initialized)) {
+        RecursiveLock_Init(&mtx->lock);
+
+        while (__strexb(&mtx->initialized, 1))
+            __ldrexb(&mtx->initialized);
+    } else {
+        __clrex();
+    }
+}
+
+void ctrdl_lockMutex(CTRDLMutex* mtx) {
+    ctrdl_mutexLazyInit(mtx);
+    RecursiveLock_Lock(&mtx->lock);
+}
+
+void ctrdl_unlockMutex(CTRDLMutex* mtx) {
+    ctrdl_mutexLazyInit(mtx);
+    RecursiveLock_Unlock(&mtx->lock);
+}
+
+bool ctrdl_getMirrorSpace(u32* base, size_t* size) {
+    *base = CODE_BASE;
+    *size = CODE_SIZE;
+    return true;
+}
+
+bool ctrdl_queryRegion(u32 addr, CTRDLRegion* out) {
+    MemInfo memInfo;
+    if (R_FAILED(ctrlQueryRegion(addr, &memInfo)))
+        return false;
+
+    out->base = memInfo.base_addr;
+    out->size = memInfo.size;
+    out->free = memInfo.state == MEMSTATE_FREE;
+    return true;
+}
+
+u32 ctrdl_allocBacking(size_t size) { return (u32)aligned_alloc(CTRL_PAGE_SIZE, size); }
+void ctrdl_freeBacking(u32 addr, size_t size) { free((void*)addr); }
+
+bool ctrdl_mirror(u32 dst, u32 src, size_t size) {
+    if (R_FAILED(ctrlMirror(dst, src, size))) {
+        ctrdl_setLastError(Err_MapFailed);
+        return false;
+    }
+
+    return true;
+}
+
+bool ctrdl_unmirror(u32 dst, u32 src, size_t size) { return R_SUCCEEDED(ctrlUnmirror(dst, src, size)); }
+bool ctrdl_changePerms(u32 addr, size_t size, u32 perms) { return R_SUCCEEDED(ctrlChangePerms(addr, size, (MemPerm)perms)); }
+
+bool ctrdl_flushCache(u32 addr, size_t size) {
+    // The whole cache is flushed, the range is only a hint.
+    return R_SUCCEEDED(ctrlFlushCache(CTRL_ICACHE | CTRL_DCACHE));
+}
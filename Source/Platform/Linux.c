@@ -0,0 +1,214 @@
+#include "../Error.h"
+#include "../Platform.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same size as the 3DS mirror space.
+#define CODE_SIZE 0x3F00000
+
+// Addresses are stored as u32, everything must live in the low 4GB.
+#if defined(MAP_32BIT)
+#define LOW_MAP_FLAGS MAP_32BIT
+#else
+#define LOW_MAP_FLAGS 0
+#endif
+
+typedef struct {
+    u32 base;
+    size_t size;
+} MappedRange;
+
+// Reserved address space, standing in for the 3DS code region.
+static u32 g_CodeBase = 0;
+
+// Ranges currently mirrored into the reserved space, sorted by address.
+static MappedRange* g_Ranges = NULL;
+static size_t g_NumRanges = 0;
+static size_t g_RangesCapacity = 0;
+static pthread_mutex_t g_RangesMtx = PTHREAD_MUTEX_INITIALIZER;
+
+// Largest block handed out by ctrdl_allocBacking, 0 for no limit.
+static size_t g_MaxBacking = 0;
+
+static void* ctrdl_mapLow(size_t size, int prot, int flags) {
+    void* p = mmap(NULL, size, prot, flags | LOW_MAP_FLAGS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    if (((uintptr_t)p + size) > UINT32_MAX) {
+        munmap(p, size);
+        return NULL;
+    }
+
+    return p;
+}
+
+static bool ctrdl_reserve(u32 addr, size_t size) {
+    void* p = mmap((void*)(uintptr_t)addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    return p != MAP_FAILED;
+}
+
+void ctrdl_lockMutex(CTRDLMutex* mtx) { pthread_mutex_lock(mtx); }
+void ctrdl_unlockMutex(CTRDLMutex* mtx) { pthread_mutex_unlock(mtx); }
+
+bool ctrdl_getMirrorSpace(u32* base, size_t* size) {
+    pthread_mutex_lock(&g_RangesMtx);
+
+    if (!g_CodeBase) {
+        void* p = ctrdl_mapLow(CODE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+        if (p)
+            g_CodeBase = (u32)(uintptr_t)p;
+    }
+
+    pthread_mutex_unlock(&g_RangesMtx);
+
+    *base = g_CodeBase;
+    *size = CODE_SIZE;
+    return g_CodeBase != 0;
+}
+
+bool ctrdl_queryRegion(u32 addr, CTRDLRegion* out) {
+    u32 spaceBase;
+    size_t spaceSize;
+    if (!ctrdl_getMirrorSpace(&spaceBase, &spaceSize))
+        return false;
+
+    const u32 spaceEnd = spaceBase + spaceSize;
+
+    // Anything outside the reserved space is considered in use.
+    if (addr < spaceBase) {
+        out->base = 0;
+        out->size = spaceBase;
+        out->free = false;
+        return true;
+    }
+
+    if (addr >= spaceEnd) {
+        out->base = spaceEnd;
+        out->size = UINT32_MAX - spaceEnd;
+        out->free = false;
+        return true;
+    }
+
+    pthread_mutex_lock(&g_RangesMtx);
+
+    u32 freeBase = spaceBase;
+    u32 freeEnd = spaceEnd;
+    bool found = false;
+
+    for (size_t i = 0; i < g_NumRanges; ++i) {
+        const MappedRange* r = &g_Ranges[i];
+
+        if (addr < r->base) {
+            freeEnd = r->base;
+            break;
+        }
+
+        if (addr < (r->base + r->size)) {
+            out->base = r->base;
+            out->size = r->size;
+            out->free = false;
+            found = true;
+            break;
+        }
+
+        freeBase = r->base + r->size;
+    }
+
+    pthread_mutex_unlock(&g_RangesMtx);
+
+    if (!found) {
+        out->base = freeBase;
+        out->size = freeEnd - freeBase;
+        out->free = true;
+    }
+
+    return true;
+}
+
+u32 ctrdl_allocBacking(size_t size) {
+    const size_t maxBacking = __atomic_load_n(&g_MaxBacking, __ATOMIC_RELAXED);
+    if (maxBacking && (size > maxBacking))
+        return 0;
+
+    // Must be shared, so that it can be aliased by ctrdl_mirror.
+    void* p = ctrdl_mapLow(size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS);
+    return (u32)(uintptr_t)p;
+}
+
+void ctrdl_setMaxBacking(size_t size) { __atomic_store_n(&g_MaxBacking, size, __ATOMIC_RELAXED); }
+
+void ctrdl_freeBacking(u32 addr, size_t size) { munmap((void*)(uintptr_t)addr, size); }
+
+bool ctrdl_mirror(u32 dst, u32 src, size_t size) {
+    bool ret = false;
+    pthread_mutex_lock(&g_RangesMtx);
+
+    if (g_NumRanges == g_RangesCapacity) {
+        const size_t newCapacity = g_RangesCapacity ? (g_RangesCapacity * 2) : 16;
+        MappedRange* newRanges = realloc(g_Ranges, newCapacity * sizeof(MappedRange));
+        if (!newRanges) {
+            ctrdl_setLastError(Err_NoMemory);
+            goto end;
+        }
+
+        g_Ranges = newRanges;
+        g_RangesCapacity = newCapacity;
+    }
+
+    // A zero old size creates a second mapping of the same shared pages.
+    void* p = mremap((void*)(uintptr_t)src, 0, size, MREMAP_MAYMOVE | MREMAP_FIXED, (void*)(uintptr_t)dst);
+    if (p == MAP_FAILED) {
+        // Private pages can't be aliased, which is the case for a caller buffer mapped in place.
+        ctrdl_setLastError((errno == EINVAL) ? Err_PrivateMapping : Err_MapFailed);
+        goto end;
+    }
+
+    size_t index = 0;
+    while ((index < g_NumRanges) && (g_Ranges[index].base < dst))
+        ++index;
+
+    memmove(&g_Ranges[index + 1], &g_Ranges[index], (g_NumRanges - index) * sizeof(MappedRange));
+    g_Ranges[index].base = dst;
+    g_Ranges[index].size = size;
+    ++g_NumRanges;
+    ret = true;
+
+end:
+    pthread_mutex_unlock(&g_RangesMtx);
+    return ret;
+}
+
+bool ctrdl_unmirror(u32 dst, u32 src, size_t size) {
+    bool ret = false;
+    pthread_mutex_lock(&g_RangesMtx);
+
+    for (size_t i = 0; i < g_NumRanges; ++i) {
+        if ((g_Ranges[i].base == dst) && (g_Ranges[i].size == size)) {
+            // Put the reservation back in place of the alias.
+            if (ctrdl_reserve(dst, size)) {
+                memmove(&g_Ranges[i], &g_Ranges[i + 1], (g_NumRanges - i - 1) * sizeof(MappedRange));
+                --g_NumRanges;
+                ret = true;
+            }
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_RangesMtx);
+    return ret;
+}
+
+bool ctrdl_changePerms(u32 addr, size_t size, u32 perms) {
+    return !mprotect((void*)(uintptr_t)addr, size, (int)perms);
+}
+
+bool ctrdl_flushCache(u32 addr, size_t size) {
+    __builtin___clear_cache((char*)(uintptr_t)addr, (char*)(uintptr_t)(addr + size));
+    return true;
+}
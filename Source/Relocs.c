@@ -1,81 +1,230 @@
-#include "CTRL/Types.h"
-
 #include "Relocs.h"
+#include "GlobalSymbols.h"
 #include "Symbol.h"
 
+#include <stdlib.h>
+
 typedef struct {
     CTRDLHandle* handle;
     CTRDLElf* elf;
+    CTRDLStream* stream;
     CTRDLResolverFn resolver;
     void* resolverUserData;
+    u32* symCache;         // Resolved addresses by symbol index, 0 if not resolved yet.
+    size_t symCacheHits;   // Lookups served by the cache.
+    size_t symCacheMisses; // Lookups which had to be resolved.
+    CTRDLError error;      // Error to report on failure.
 } RelContext;
 
 typedef struct {
-  uintptr_t offset;
-  uintptr_t symbol;
-  uint32_t addend;
-  uint8_t type;
-} RelEntry;
-
-static u32 ctrdl_resolveSymbol(const RelContext* ctx, Elf32_Word index) {
-    if (index == STN_UNDEF)
-        return 0;
+    const u8* data;
+    const u8* end;
+} PackedReader;
 
-    const char* name = &ctx->elf->stringTable[ctx->elf->symEntries[index].st_name];
+// Android packed relocation group flags.
+#define APS2_GROUPED_BY_INFO 0x1
+#define APS2_GROUPED_BY_OFFSET_DELTA 0x2
+#define APS2_GROUPED_BY_ADDEND 0x4
+#define APS2_GROUP_HAS_ADDEND 0x8
 
+static u32 ctrdl_lookupSymbol(CTRDLHandle* handle, const Elf32_Sym* self, const char* name, CTRDLResolverFn resolver, void* resolverUserData) {
     // If we have a resolver, use it first.
-    if (ctx->resolver) {
-        u32 addr = (u32)ctx->resolver(name, ctx->resolverUserData);
+    if (resolver) {
+        u32 addr = (u32)resolver(name, resolverUserData);
         if (addr)
             return addr;
     }
 
-    // Look into global objects.
-    const Elf32_Sym* sym = NULL;
+    // Look into global objects, the mutex is taken for each lookup and only guards the index.
+    // Symbol values are relative to the object which defines them.
     ctrdl_acquireHandleMtx();
+    CTRDLHandle* owner = NULL;
+    const Elf32_Sym* sym = ctrdl_unsafeFindGlobalSymbol(name, &owner);
+    const u32 globalAddr = sym ? (owner->base + sym->st_value) : 0;
+    ctrdl_releaseHandleMtx();
+
+    if (globalAddr)
+        return globalAddr;
+
+    // Look into the object itself.
+    if (self->st_shndx != SHN_UNDEF)
+        return handle->base + self->st_value;
 
-    for (size_t i = 0; i < CTRDL_MAX_HANDLES; ++i) {
-        CTRDLHandle* h = ctrdl_unsafeGetHandleByIndex(i);
-        if (h->refc && (h->flags & RTLD_GLOBAL)) {
-            sym = ctrdl_findSymbolFromName(h, name);
+    // Look into dependencies, these are kept alive by the references on them.
+    for (size_t i = 0; i < handle->numDeps; ++i) {
+        CTRDLHandle* dep = handle->deps[i];
+        if (!(dep->flags & RTLD_GLOBAL)) {
+            sym = ctrdl_unsafeFindSymbolFromName(dep, name);
             if (sym)
-                break;
+                return dep->base + sym->st_value;
         }
     }
 
-    ctrdl_releaseHandleMtx();
+    return 0;
+}
 
-    if (!sym) {
-        // Look into dependencies.
-        for (size_t i = 0; i < CTRDL_MAX_DEPS; ++i) {
-            CTRDLHandle* dep = ctx->handle->deps[i];
-            if (dep && !(dep->flags & RTLD_GLOBAL)) {
-                sym = ctrdl_findSymbolFromName(dep, name);
-                if (sym)
-                    break;
-            }
+static u32 ctrdl_resolveSymbol(RelContext* ctx, Elf32_Word index) {
+    if ((index == STN_UNDEF) || (index >= ctx->elf->numOfSymChains))
+        return 0;
+
+    if (ctx->symCache && ctx->symCache[index]) {
+        ++ctx->symCacheHits;
+        return ctx->symCache[index];
+    }
+
+    ++ctx->symCacheMisses;
+    const Elf32_Sym* sym = &ctx->elf->symEntries[index];
+    const char* name = &ctx->elf->stringTable[sym->st_name];
+    const u32 addr = ctrdl_lookupSymbol(ctx->handle, sym, name, ctx->resolver, ctx->resolverUserData);
+    if (ctx->symCache)
+        ctx->symCache[index] = addr;
+
+    return addr;
+}
+
+static bool ctrdl_resolveImports(RelContext* ctx, CTRDLBatchResolverFn batchResolver, void* userData) {
+    const CTRDLElf* elf = ctx->elf;
+
+    size_t count = 0;
+    for (size_t i = 1; i < elf->numOfSymChains; ++i) {
+        const Elf32_Sym* sym = &elf->symEntries[i];
+        if (sym->st_name && (sym->st_shndx == SHN_UNDEF))
+            ++count;
+    }
+
+    if (!count)
+        return true;
+
+    const char** names = malloc(count * sizeof(const char*));
+    void** addrs = calloc(count, sizeof(void*));
+    Elf32_Word* indices = malloc(count * sizeof(Elf32_Word));
+    if (!names || !addrs || !indices) {
+        free(names);
+        free(addrs);
+        free(indices);
+        return false;
+    }
+
+    count = 0;
+    for (size_t i = 1; i < elf->numOfSymChains; ++i) {
+        const Elf32_Sym* sym = &elf->symEntries[i];
+        if (sym->st_name && (sym->st_shndx == SHN_UNDEF)) {
+            names[count] = &elf->stringTable[sym->st_name];
+            indices[count] = i;
+            ++count;
         }
     }
 
-    return sym ? (ctx->handle->base + sym->st_value) : 0;
+    // Unresolved imports are left to the regular lookup.
+    batchResolver(names, addrs, count, userData);
+
+    for (size_t i = 0; i < count; ++i)
+        ctx->symCache[indices[i]] = (u32)addrs[i];
+
+    free(names);
+    free(addrs);
+    free(indices);
+    return true;
+}
+
+// The leading DT_RELCOUNT entries are known to be R_ARM_RELATIVE.
+static void ctrdl_handleRelCount(u32 base, const Elf32_Rel* relArray, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        *(u32*)(base + relArray[i].r_offset) += base;
+}
+
+static void ctrdl_handleRelaCount(u32 base, const Elf32_Rela* relaArray, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        *(u32*)(base + relaArray[i].r_offset) = base + relaArray[i].r_addend;
+}
+
+static void ctrdl_handleRelRelative(u32 base, const Elf32_Rel* relArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ELF32_R_TYPE(relArray[i].r_info) == R_ARM_RELATIVE)
+            *(u32*)(base + relArray[i].r_offset) += base;
+    }
+}
+
+static void ctrdl_handleRelaRelative(u32 base, const Elf32_Rela* relaArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ELF32_R_TYPE(relaArray[i].r_info) == R_ARM_RELATIVE)
+            *(u32*)(base + relaArray[i].r_offset) = base + relaArray[i].r_addend;
+    }
 }
 
-static bool ctrdl_handleSingleReloc(RelContext* ctx, RelEntry* entry) {
-    u32* dst = (u32*)entry->offset;
+static void ctrdl_handleRelr(u32 base, const Elf32_Word* relrArray, size_t count) {
+    u32 where = 0;
 
-    switch (entry->type) {
+    for (size_t i = 0; i < count; ++i) {
+        const Elf32_Word entry = relrArray[i];
+
+        if (!(entry & 1)) {
+            // An address, relocate it and start a bitmap after it.
+            where = base + entry;
+            *(u32*)where += base;
+            where += sizeof(u32);
+        } else {
+            // A bitmap, each bit after the first one is a word to relocate.
+            u32 p = where;
+            for (Elf32_Word bits = entry >> 1; bits; bits >>= 1) {
+                if (bits & 1)
+                    *(u32*)p += base;
+
+                p += sizeof(u32);
+            }
+
+            where += 31 * sizeof(u32);
+        }
+    }
+}
+
+static bool ctrdl_applyRel(RelContext* ctx, const Elf32_Rel* rel) {
+    u32* dst = (u32*)(ctx->handle->base + rel->r_offset);
+    u32 symbol;
+
+    switch (ELF32_R_TYPE(rel->r_info)) {
+        case R_ARM_NONE:
+            return true;
         case R_ARM_RELATIVE:
-            if (entry->addend) {
-                *dst = ctx->handle->base + entry->addend;
-            } else {
-                *dst += ctx->handle->base;
+            *dst += ctx->handle->base;
+            return true;
+        case R_ARM_ABS32:
+            // The addend is stored in place.
+            symbol = ctrdl_resolveSymbol(ctx, ELF32_R_SYM(rel->r_info));
+            if (symbol) {
+                *dst += symbol;
+                return true;
+            }
+            break;
+        case R_ARM_GLOB_DAT:
+        case R_ARM_JUMP_SLOT:
+            symbol = ctrdl_resolveSymbol(ctx, ELF32_R_SYM(rel->r_info));
+            if (symbol) {
+                *dst = symbol;
+                return true;
             }
+            break;
+    }
+
+    return false;
+}
+
+static bool ctrdl_applyRela(RelContext* ctx, const Elf32_Rela* rela) {
+    u32* dst = (u32*)(ctx->handle->base + rela->r_offset);
+    u32 symbol;
+
+    switch (ELF32_R_TYPE(rela->r_info)) {
+        case R_ARM_NONE:
+            return true;
+        case R_ARM_RELATIVE:
+            *dst = ctx->handle->base + rela->r_addend;
             return true;
         case R_ARM_ABS32:
         case R_ARM_GLOB_DAT:
         case R_ARM_JUMP_SLOT:
-            if (entry->symbol) {
-                *dst = entry->symbol + entry->addend;
+            symbol = ctrdl_resolveSymbol(ctx, ELF32_R_SYM(rela->r_info));
+            if (symbol) {
+                *dst = symbol + rela->r_addend;
                 return true;
             }
             break;
@@ -84,56 +233,418 @@ static bool ctrdl_handleSingleReloc(RelContext* ctx, RelEntry* entry) {
     return false;
 }
 
-static bool ctrdl_handleRel(RelContext* ctx) {
-    const Elf32_Rel* relArray = ctx->elf->relArray;
+static bool ctrdl_handleRelSymbolic(RelContext* ctx, const Elf32_Rel* relArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const Elf32_Rel* rel = &relArray[i];
+        if ((ELF32_R_TYPE(rel->r_info) != R_ARM_RELATIVE) && !ctrdl_applyRel(ctx, rel))
+            return false;
+    }
+
+    return true;
+}
+
+static bool ctrdl_handleRelaSymbolic(RelContext* ctx, const Elf32_Rela* relaArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const Elf32_Rela* rela = &relaArray[i];
+        if ((ELF32_R_TYPE(rela->r_info) != R_ARM_RELATIVE) && !ctrdl_applyRela(ctx, rela))
+            return false;
+    }
+
+    return true;
+}
+
+static bool ctrdl_handleRelAll(RelContext* ctx, const Elf32_Rel* relArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!ctrdl_applyRel(ctx, &relArray[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static bool ctrdl_handleRelaAll(RelContext* ctx, const Elf32_Rela* relaArray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        if (!ctrdl_applyRela(ctx, &relaArray[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static void ctrdl_handleTableRelative(u32 base, const CTRDLRelTable* table) {
+    // Streamed tables are handled in a single pass.
+    if (!table->entries)
+        return;
+
+    const size_t relative = table->relativeCount;
+    if (table->isRela) {
+        const Elf32_Rela* relaArray = table->entries;
+        ctrdl_handleRelaCount(base, relaArray, relative);
+        ctrdl_handleRelaRelative(base, relaArray + relative, table->count - relative);
+    } else {
+        const Elf32_Rel* relArray = table->entries;
+        ctrdl_handleRelCount(base, relArray, relative);
+        ctrdl_handleRelRelative(base, relArray + relative, table->count - relative);
+    }
+}
+
+static bool ctrdl_handleTableSymbolic(RelContext* ctx, const CTRDLRelTable* table) {
+    if (!table->entries)
+        return true;
+
+    const size_t relative = table->relativeCount;
+    if (table->isRela)
+        return ctrdl_handleRelaSymbolic(ctx, (const Elf32_Rela*)table->entries + relative, table->count - relative);
+
+    return ctrdl_handleRelSymbolic(ctx, (const Elf32_Rel*)table->entries + relative, table->count - relative);
+}
+
+// PLT slots initially point to PLT0, which jumps to the trampoline through GOT[2].
+static bool ctrdl_handleLazyTable(RelContext* ctx, const CTRDLRelTable* table) {
+    CTRDLHandle* handle = ctx->handle;
+    const u32 base = handle->base;
+
+    handle->lazyBound = calloc((table->count + 31) / 32, sizeof(u32));
+    if (!handle->lazyBound) {
+        ctx->error = Err_NoMemory;
+        return false;
+    }
 
-    if (relArray) {
-        const size_t size = ctx->elf->relArraySize;
-        for (size_t i = 0; i < size; ++i) {
-            RelEntry entry;
-            const Elf32_Rel* rel = &relArray[i];
+    for (size_t i = 0; i < table->count; ++i) {
+        const Elf32_Rel* rel = table->isRela ? (const Elf32_Rel*)&((const Elf32_Rela*)table->entries)[i] : &((const Elf32_Rel*)table->entries)[i];
 
-            entry.offset = ctx->handle->base + rel->r_offset;
-            entry.symbol = ctrdl_resolveSymbol(ctx, ELF32_R_SYM(rel->r_info));
-            entry.addend = 0;
-            entry.type = ELF32_R_TYPE(rel->r_info);
+        if (ELF32_R_TYPE(rel->r_info) == R_ARM_JUMP_SLOT) {
+            *(u32*)(base + rel->r_offset) += base;
+            ++handle->numLazySlots;
+        } else {
+            // Anything else is bound now.
+            handle->lazyBound[i / 32] |= 1u << (i % 32);
 
-            if (!ctrdl_handleSingleReloc(ctx, &entry))
+            const bool success = table->isRela ? ctrdl_applyRela(ctx, &((const Elf32_Rela*)table->entries)[i]) : ctrdl_applyRel(ctx, rel);
+            if (!success)
                 return false;
         }
     }
 
+    u32* got = (u32*)(base + ctx->elf->pltGot);
+    got[1] = (u32)handle;
+    got[2] = (u32)ctrdl_lazyTrampoline;
+    return true;
+}
+
+// Tables outside of the image are read in chunks and applied as they arrive.
+static bool ctrdl_streamTable(RelContext* ctx, const CTRDLRelTable* table, void* chunk) {
+    if (table->entries || !table->count)
+        return true;
+
+    const u32 base = ctx->handle->base;
+    const size_t entrySize = table->isRela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+    const size_t entriesPerChunk = CTRDL_RELOC_CHUNK_SIZE / entrySize;
+
+    if (!ctrdl_streamSeek(ctx->stream, table->offset)) {
+        ctx->error = Err_ReadFailed;
+        return false;
+    }
+
+    for (size_t start = 0; start < table->count; start += entriesPerChunk) {
+        const size_t remaining = table->count - start;
+        const size_t count = (remaining < entriesPerChunk) ? remaining : entriesPerChunk;
+        if (!ctrdl_streamRead(ctx->stream, chunk, count * entrySize)) {
+            ctx->error = Err_ReadFailed;
+            return false;
+        }
+
+        size_t relative = 0;
+        if (table->relativeCount > start)
+            relative = ((table->relativeCount - start) < count) ? (table->relativeCount - start) : count;
+
+        bool success;
+        if (table->isRela) {
+            ctrdl_handleRelaCount(base, chunk, relative);
+            success = ctrdl_handleRelaAll(ctx, (const Elf32_Rela*)chunk + relative, count - relative);
+        } else {
+            ctrdl_handleRelCount(base, chunk, relative);
+            success = ctrdl_handleRelAll(ctx, (const Elf32_Rel*)chunk + relative, count - relative);
+        }
+
+        if (!success)
+            return false;
+    }
+
+    return true;
+}
+
+static bool ctrdl_readSLEB128(PackedReader* reader, s32* out) {
+    u32 value = 0;
+    size_t shift = 0;
+    u8 byte;
+
+    do {
+        if (reader->data >= reader->end)
+            return false;
+
+        byte = *reader->data++;
+        if (shift < 32)
+            value |= (u32)(byte & 0x7F) << shift;
+
+        shift += 7;
+    } while (byte & 0x80);
+
+    // Sign extend.
+    if ((shift < 32) && (byte & 0x40))
+        value |= ~0u << shift;
+
+    *out = (s32)value;
     return true;
 }
 
-static bool ctrdl_handleRela(RelContext* ctx) {
-    const Elf32_Rela* relaArray = ctx->elf->relaArray;
+// Android packed relocations, entries are decoded one at a time and applied as they come.
+static bool ctrdl_handleAndroidPacked(RelContext* ctx, const void* table, size_t size, bool isRela) {
+    PackedReader reader;
+    reader.data = (const u8*)table + 4;
+    reader.end = (const u8*)table + size;
 
-    if (relaArray) {
-        const size_t size = ctx->elf->relaArraySize;
+    s32 numRelocs;
+    s32 offset;
+    if (!ctrdl_readSLEB128(&reader, &numRelocs) || !ctrdl_readSLEB128(&reader, &offset) || (numRelocs < 0))
+        return false;
 
-        for (size_t i = 0; i < size; ++i) {
-            RelEntry entry;
-            const Elf32_Rela* rela = &relaArray[i];
+    Elf32_Rela rela;
+    rela.r_offset = offset;
+    rela.r_info = 0;
+    rela.r_addend = 0;
 
-            entry.offset = ctx->handle->base + rela->r_offset;
-            entry.symbol = ctrdl_resolveSymbol(ctx, ELF32_R_SYM(rela->r_info));
-            entry.addend = rela->r_addend;
-            entry.type = ELF32_R_TYPE(rela->r_info);
+    s32 groupSize = 0;
+    s32 groupFlags = 0;
+    s32 groupOffsetDelta = 0;
+    s32 value;
 
-            if (!ctrdl_handleSingleReloc(ctx, &entry))
+    for (s32 i = 0; i < numRelocs; i += groupSize) {
+        if (!ctrdl_readSLEB128(&reader, &groupSize) || !ctrdl_readSLEB128(&reader, &groupFlags) || (groupSize <= 0))
+            return false;
+
+        const bool hasAddend = groupFlags & APS2_GROUP_HAS_ADDEND;
+        if ((groupFlags & APS2_GROUPED_BY_OFFSET_DELTA) && !ctrdl_readSLEB128(&reader, &groupOffsetDelta))
+            return false;
+
+        if (groupFlags & APS2_GROUPED_BY_INFO) {
+            if (!ctrdl_readSLEB128(&reader, &value))
+                return false;
+
+            rela.r_info = value;
+        }
+
+        if (hasAddend && !isRela)
+            return false;
+
+        if (hasAddend && (groupFlags & APS2_GROUPED_BY_ADDEND)) {
+            if (!ctrdl_readSLEB128(&reader, &value))
                 return false;
+
+            rela.r_addend += value;
+        } else if (!hasAddend) {
+            rela.r_addend = 0;
+        }
+
+        for (s32 j = 0; (j < groupSize) && ((i + j) < numRelocs); ++j) {
+            if (groupFlags & APS2_GROUPED_BY_OFFSET_DELTA) {
+                rela.r_offset += groupOffsetDelta;
+            } else {
+                if (!ctrdl_readSLEB128(&reader, &value))
+                    return false;
+
+                rela.r_offset += value;
+            }
+
+            if (!(groupFlags & APS2_GROUPED_BY_INFO)) {
+                if (!ctrdl_readSLEB128(&reader, &value))
+                    return false;
+
+                rela.r_info = value;
+            }
+
+            if (hasAddend && !(groupFlags & APS2_GROUPED_BY_ADDEND)) {
+                if (!ctrdl_readSLEB128(&reader, &value))
+                    return false;
+
+                rela.r_addend += value;
+            }
+
+            if (isRela) {
+                if (!ctrdl_applyRela(ctx, &rela))
+                    return false;
+            } else {
+                Elf32_Rel rel;
+                rel.r_offset = rela.r_offset;
+                rel.r_info = rela.r_info;
+                if (!ctrdl_applyRel(ctx, &rel))
+                    return false;
+            }
         }
     }
 
     return true;
 }
 
-bool ctrdl_handleRelocs(CTRDLHandle* handle, CTRDLElf* elf, CTRDLResolverFn resolver, void* resolverUserData) {
+bool ctrdl_handleRelocs(CTRDLHandle* handle, CTRDLElf* elf, CTRDLStream* stream, const CTRDLResolver* resolver) {
     RelContext ctx;
     ctx.handle = handle;
     ctx.elf = elf;
-    ctx.resolver = resolver;
-    ctx.resolverUserData = resolverUserData;
-    return ctrdl_handleRel(&ctx) && ctrdl_handleRela(&ctx);
-}
\ No newline at end of file
+    ctx.stream = stream;
+    ctx.resolver = resolver->fn;
+    ctx.resolverUserData = resolver->userData;
+    ctx.symCacheHits = 0;
+    ctx.symCacheMisses = 0;
+    ctx.error = Err_RelocFailed;
+
+    // Kept for lazy binding.
+    handle->resolver = resolver->fn;
+    handle->resolverUserData = resolver->userData;
+
+    const CTRDLRelTable* tables[] = { &elf->relTable, &elf->relaTable, &elf->jmpRelTable };
+    const size_t numTables = sizeof(tables) / sizeof(tables[0]);
+
+    void* chunk = NULL;
+    for (size_t i = 0; i < numTables; ++i) {
+        if (!tables[i]->entries && tables[i]->count) {
+            chunk = malloc(CTRDL_RELOC_CHUNK_SIZE);
+            if (!chunk) {
+                ctrdl_setLastError(Err_NoMemory);
+                return false;
+            }
+
+            break;
+        }
+    }
+
+    // Imports are usually referenced by several relocations, resolve each once.
+    // Without memory for the cache every relocation is resolved on its own.
+    ctx.symCache = calloc(elf->numOfSymChains, sizeof(u32));
+
+    // Batch resolved imports go straight into the cache, which is then required.
+    if (resolver->batchFn && (!ctx.symCache || !ctrdl_resolveImports(&ctx, resolver->batchFn, resolver->userData))) {
+        ctrdl_setLastError(Err_NoMemory);
+        free(ctx.symCache);
+        free(chunk);
+        return false;
+    }
+
+    // Relative relocations first, they need no lookup.
+    for (size_t i = 0; i < numTables; ++i)
+        ctrdl_handleTableRelative(handle->base, tables[i]);
+
+    ctrdl_handleRelr(handle->base, elf->relrArray, elf->relrArraySize);
+
+    // Then symbolic ones, streamed and Android packed tables mix both kinds.
+    // The resolver is called without the handle mutex held, it may wait on other threads.
+    bool ret = true;
+
+    // Lazy binding needs the PLT relocations in the image and room for the reserved GOT entries.
+    const CTRDLRelTable* jmpRel = &elf->jmpRelTable;
+    // Batch resolved imports are bound at load, as the resolver is called once.
+    const bool lazy = (handle->flags & RTLD_LAZY) && !resolver->batchFn && jmpRel->inImage && jmpRel->count && elf->pltGot &&
+                      ((elf->pltGot + (3 * sizeof(u32))) <= handle->size);
+
+    for (size_t i = 0; ret && (i < numTables); ++i) {
+        if (lazy && (tables[i] == jmpRel)) {
+            ret = ctrdl_handleLazyTable(&ctx, jmpRel);
+        } else {
+            ret = ctrdl_handleTableSymbolic(&ctx, tables[i]) && ctrdl_streamTable(&ctx, tables[i], chunk);
+        }
+    }
+
+    if (ret && elf->androidRel)
+        ret = ctrdl_handleAndroidPacked(&ctx, elf->androidRel, elf->androidRelSize, false);
+
+    if (ret && elf->androidRela)
+        ret = ctrdl_handleAndroidPacked(&ctx, elf->androidRela, elf->androidRelaSize, true);
+
+    free(ctx.symCache);
+    free(chunk);
+    handle->symCacheHits = ctx.symCacheHits;
+    handle->symCacheMisses = ctx.symCacheMisses;
+
+    if (!ret)
+        ctrdl_setLastError(ctx.error);
+
+    return ret;
+}
+
+u32 ctrdl_bindLazySlot(CTRDLHandle* handle, u32 slot) {
+    const size_t entrySize = handle->jmpRelIsRela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+    const Elf32_Addr offset = slot - handle->base;
+
+    // Slots usually follow the reserved GOT entries in relocation order.
+    size_t first = 0;
+    const size_t guess = (offset - handle->pltGot) / sizeof(u32) - 3;
+    if ((offset >= (handle->pltGot + (3 * sizeof(u32)))) && (guess < handle->numJmpRelEntries))
+        first = guess;
+
+    for (size_t n = 0; handle->lazyBound && (n < handle->numJmpRelEntries); ++n) {
+        const size_t i = (first + n) % handle->numJmpRelEntries;
+        const Elf32_Rel* rel = (const Elf32_Rel*)((const u8*)handle->jmpRelEntries + (i * entrySize));
+        if (rel->r_offset != offset)
+            continue;
+
+        const Elf32_Word index = ELF32_R_SYM(rel->r_info);
+        if ((index == STN_UNDEF) || (index >= handle->numSymChains))
+            return 0;
+
+        // Resolved without the mutex, the resolver may wait on other threads.
+        const Elf32_Sym* sym = &handle->symEntries[index];
+        u32 addr = ctrdl_lookupSymbol(handle, sym, &handle->stringTable[sym->st_name], handle->resolver, handle->resolverUserData);
+        if (!addr)
+            return 0;
+
+        if (handle->jmpRelIsRela)
+            addr += ((const Elf32_Rela*)rel)->r_addend;
+
+        // Another thread may have got here first, both resolved the same address.
+        ctrdl_acquireHandleMtx();
+        if (!(handle->lazyBound[i / 32] & (1u << (i % 32)))) {
+            *(u32*)slot = addr;
+            handle->lazyBound[i / 32] |= 1u << (i % 32);
+            ++handle->numBoundSlots;
+        }
+        ctrdl_releaseHandleMtx();
+
+        return addr;
+    }
+
+    return 0;
+}
+
+u32 ctrdl_lazyResolve(CTRDLHandle* handle, u32 slot) {
+    const u32 addr = ctrdl_bindLazySlot(handle, slot);
+    if (!addr) {
+        // There is no way to report the error to the caller.
+        ctrdl_setLastError(Err_NotFound);
+        abort();
+    }
+
+    return addr;
+}
+
+#if defined(__arm__)
+
+// Entered from PLT0 with the caller lr pushed, lr pointing to GOT[2] and ip to the slot.
+__attribute__((naked)) void ctrdl_lazyTrampoline(void) {
+    __asm__ volatile(
+        "push {r0-r4}\n"
+        "vpush {d0-d7}\n"
+        "ldr r0, [lr, #-4]\n"
+        "mov r1, ip\n"
+        "bl ctrdl_lazyResolve\n"
+        "mov ip, r0\n"
+        "vpop {d0-d7}\n"
+        "pop {r0-r4}\n"
+        "pop {lr}\n"
+        "bx ip\n");
+}
+
+#else
+
+// Objects can't be run on other architectures, slots are only bound through ctrdl_bindLazySlot.
+void ctrdl_lazyTrampoline(void) { abort(); }
+
+#endif
@@ -3,7 +3,18 @@
 
 #include "ELFUtil.h"
 #include "Handle.h"
+#include "Stream.h"
 
-bool ctrdl_handleRelocs(CTRDLHandle* handle, CTRDLElf* elf, CTRDLResolverFn resolver, void* resolverUserData);
+// Relocation tables which are not part of a loaded segment are read through a buffer of this size.
+#ifndef CTRDL_RELOC_CHUNK_SIZE
+#define CTRDL_RELOC_CHUNK_SIZE 0xC00
+#endif
+
+bool ctrdl_handleRelocs(CTRDLHandle* handle, CTRDLElf* elf, CTRDLStream* stream, const CTRDLResolver* resolver);
+
+// Lazy binding, PLT0 jumps to the trampoline which binds the slot and jumps to the target.
+u32 ctrdl_bindLazySlot(CTRDLHandle* handle, u32 slot);
+u32 ctrdl_lazyResolve(CTRDLHandle* handle, u32 slot);
+void ctrdl_lazyTrampoline(void);
 
 #endif /* _CTRDL_RELOCS_H */
\ No newline at end of file
@@ -1,7 +1,13 @@
 #include "Stream.h"
 
+#include <stdint.h>
 #include <string.h>
 
+// Gaps up to this size are read through rather than seeked over, as seeking
+// discards the stdio buffer.
+#define MAX_READ_GAP 0x1000
+#define GAP_BUFFER_SIZE 0x200
+
 static bool ctrdl_fileSeekImpl(void* stream, size_t offset) {
     return !fseek((FILE*)((CTRDLStream*)stream)->handle, offset, SEEK_SET);
 }
@@ -46,16 +52,132 @@ static bool ctrdl_memReadImpl(void* s, void* out, size_t size) {
     return false;
 }
 
+static const void* ctrdl_memPeekImpl(void* s, size_t offset, size_t size) {
+    CTRDLStream* stream = (CTRDLStream*)s;
+    if ((offset <= stream->size) && (size <= (stream->size - offset)))
+        return (const void*)((const u8*)(stream->handle) + offset);
+
+    return NULL;
+}
+
+static void ctrdl_resetStream(CTRDLStream* stream) {
+    stream->cursor = SIZE_MAX;
+    memset(&stream->stats, 0, sizeof(CTRDLStreamStats));
+}
+
+static bool ctrdl_skipGap(CTRDLStream* stream, size_t size) {
+    u8 buffer[GAP_BUFFER_SIZE];
+
+    while (size) {
+        const size_t toRead = size < sizeof(buffer) ? size : sizeof(buffer);
+        if (!ctrdl_streamRead(stream, buffer, toRead))
+            return false;
+
+        size -= toRead;
+    }
+
+    return true;
+}
+
 void ctrdl_makeFileStream(CTRDLStream* stream, FILE* f) {
     stream->handle = (void*)f;
     stream->seek = ctrdl_fileSeekImpl;
     stream->read = ctrdl_fileReadImpl;
+    stream->peek = NULL;
+    ctrdl_resetStream(stream);
 }
 
 void ctrdl_makeMemStream(CTRDLStream* stream, const void* buffer, size_t size) {
     stream->handle = (void*)buffer;
     stream->seek = ctrdl_memSeekImpl;
     stream->read = ctrdl_memReadImpl;
-    stream->size = 0;
+    stream->peek = ctrdl_memPeekImpl;
+    stream->size = size;
     stream->offset = 0;
-}
\ No newline at end of file
+    ctrdl_resetStream(stream);
+}
+
+bool ctrdl_streamSeek(CTRDLStream* stream, size_t offset) {
+    if (stream->cursor == offset)
+        return true;
+
+    ++stream->stats.numSeeks;
+    if (!stream->seek(stream, offset)) {
+        stream->cursor = SIZE_MAX;
+        return false;
+    }
+
+    stream->cursor = offset;
+    return true;
+}
+
+bool ctrdl_streamRead(CTRDLStream* stream, void* out, size_t size) {
+    ++stream->stats.numReads;
+    if (!stream->read(stream, out, size)) {
+        stream->cursor = SIZE_MAX;
+        return false;
+    }
+
+    stream->stats.bytesRead += size;
+    if (stream->cursor != SIZE_MAX)
+        stream->cursor += size;
+
+    return true;
+}
+
+bool ctrdl_streamReadRanges(CTRDLStream* stream, CTRDLReadRange* ranges, size_t count) {
+    // Addressable streams are copied from directly, in any order.
+    if (stream->peek) {
+        for (size_t i = 0; i < count; ++i) {
+            const void* data = ctrdl_streamPeek(stream, ranges[i].offset, ranges[i].size);
+            if (!data)
+                return false;
+
+            memcpy(ranges[i].out, data, ranges[i].size);
+            ++stream->stats.numReads;
+            stream->stats.bytesRead += ranges[i].size;
+        }
+
+        return true;
+    }
+
+    // Sort by offset, plans are small.
+    for (size_t i = 1; i < count; ++i) {
+        CTRDLReadRange range = ranges[i];
+        size_t j = i;
+
+        while (j && (ranges[j - 1].offset > range.offset)) {
+            ranges[j] = ranges[j - 1];
+            --j;
+        }
+
+        ranges[j] = range;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const CTRDLReadRange* range = &ranges[i];
+        if (!range->size)
+            continue;
+
+        // Adjacent ranges need no seek at all.
+        const size_t cursor = stream->cursor;
+        if ((cursor != SIZE_MAX) && (range->offset > cursor) && ((range->offset - cursor) <= MAX_READ_GAP)) {
+            if (!ctrdl_skipGap(stream, range->offset - cursor))
+                return false;
+        } else if (!ctrdl_streamSeek(stream, range->offset)) {
+            return false;
+        }
+
+        if (!ctrdl_streamRead(stream, range->out, range->size))
+            return false;
+    }
+
+    return true;
+}
+
+const void* ctrdl_streamPeek(CTRDLStream* stream, size_t offset, size_t size) {
+    if (!stream->peek)
+        return NULL;
+
+    return stream->peek(stream, offset, size);
+}
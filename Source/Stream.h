@@ -6,16 +6,39 @@
 
 typedef bool(*CTRDLSeekFn)(void* stream, size_t offset);
 typedef bool(*CTRDLReadFn)(void* stream, void* out, size_t size);
+typedef const void*(*CTRDLPeekFn)(void* stream, size_t offset, size_t size);
 
 typedef struct {
-    void* handle;     // Opaque handle.
-    CTRDLSeekFn seek; // Seek function.
-    CTRDLReadFn read; // Read function.
-    size_t size;      // Stream size (memory only).
-    size_t offset;    // Stream offset (memory only).
+    size_t numReads;  // Number of read calls.
+    size_t numSeeks;  // Number of seek calls.
+    size_t bytesRead; // Total bytes read, including skipped gaps.
+} CTRDLStreamStats;
+
+typedef struct {
+    void* handle;           // Opaque handle.
+    CTRDLSeekFn seek;       // Seek function.
+    CTRDLReadFn read;       // Read function.
+    CTRDLPeekFn peek;       // Direct access function, NULL if the stream isn't addressable.
+    size_t size;            // Stream size (memory only).
+    size_t offset;          // Stream offset (memory only).
+    size_t cursor;          // Current offset as seen by readers, SIZE_MAX if unknown.
+    CTRDLStreamStats stats; // Access statistics.
 } CTRDLStream;
 
+typedef struct {
+    size_t offset; // Stream offset.
+    size_t size;   // Number of bytes.
+    void* out;     // Output buffer.
+} CTRDLReadRange;
+
 void ctrdl_makeFileStream(CTRDLStream* stream, FILE* f);
 void ctrdl_makeMemStream(CTRDLStream* stream, const void* buffer, size_t size);
 
-#endif /* _CTRDL_STREAM_H */
\ No newline at end of file
+bool ctrdl_streamSeek(CTRDLStream* stream, size_t offset);
+bool ctrdl_streamRead(CTRDLStream* stream, void* out, size_t size);
+bool ctrdl_streamReadRanges(CTRDLStream* stream, CTRDLReadRange* ranges, size_t count);
+
+// Returns the data at offset without copying it, NULL if unsupported or out of bounds.
+const void* ctrdl_streamPeek(CTRDLStream* stream, size_t offset, size_t size);
+
+#endif /* _CTRDL_STREAM_H */
@@ -1,85 +1,164 @@
 #include "Symbol.h"
+#include "Error.h"
 
-typedef struct {
-    CTRDLHandle* deps[CTRDL_MAX_HANDLES];
-    size_t size;
-    size_t index;
-} DepQueue;
+#include <stdlib.h>
 
-static CTRL_INLINE void ctrdl_depQueueInit(DepQueue* q) {
-    q->size = 0;
-    q->index = 0;
+static CTRDL_INLINE bool ctrdl_symbolMatches(CTRDLHandle* handle, const Elf32_Sym* sym, const char* name) {
+    return (sym->st_shndx != SHN_UNDEF) && !strcmp(&handle->stringTable[sym->st_name], name);
 }
 
-static CTRL_INLINE bool ctrdl_depQueueIsEmpty(DepQueue* q) { return q->size == 0; }
-static CTRL_INLINE bool ctrdl_depQueueIsFull(DepQueue* q) { return q->size >= CTRDL_MAX_HANDLES; }
+// Both take the symbol entries loaded with acquire semantics, the other tables are only valid after that.
+static const Elf32_Sym* ctrdl_findSymbolSysV(CTRDLHandle* handle, const Elf32_Sym* symEntries, const char* name, Elf32_Word hash) {
+    size_t chainIndex = handle->symBuckets[hash % handle->numSymBuckets];
 
-static void ctrdl_depQueuePush(DepQueue* q, CTRDLHandle* handle) {
-    if (handle && !ctrdl_depQueueIsFull(q)) {
-        for (size_t i = 0; i < q->size; ++i) {
-            if (q->deps[i] == handle)
-                return;
-        }
+    while ((chainIndex != STN_UNDEF) && (chainIndex < handle->numSymChains)) {
+        const Elf32_Sym* sym = &symEntries[chainIndex];
+        if (ctrdl_symbolMatches(handle, sym, name))
+            return sym;
 
-        q->deps[q->size % CTRDL_MAX_HANDLES] = handle;
-        ++q->size;
+        chainIndex = handle->symChains[chainIndex];
     }
+
+    return NULL;
 }
 
-static CTRDLHandle* ctrdl_depQueuePop(DepQueue* q) {
-    if (!ctrdl_depQueueIsEmpty(q)) {
-        CTRDLHandle* h = q->deps[q->index];
-        q->index = (q->index + 1) % CTRDL_MAX_HANDLES;
-        --q->size;
-        return h;
+static const Elf32_Sym* ctrdl_findSymbolGNU(CTRDLHandle* handle, const Elf32_Sym* symEntries, const char* name, Elf32_Word hash) {
+    // Both bits must be set in the bloom filter, or the symbol isn't there.
+    const Elf32_Word word = handle->bloom[(hash / 32) & (handle->bloomSize - 1)];
+    const Elf32_Word mask = (1u << (hash % 32)) | (1u << ((hash >> handle->bloomShift) % 32));
+    if ((word & mask) != mask)
+        return NULL;
+
+    size_t index = handle->symBuckets[hash % handle->numSymBuckets];
+    if (index < handle->symOffset)
+        return NULL;
+
+    // Chains are sorted by bucket, the low bit marks the end of one.
+    while (index < handle->numSymChains) {
+        const Elf32_Word chainHash = handle->symChains[index - handle->symOffset];
+        if (((chainHash | 1) == (hash | 1)) && ctrdl_symbolMatches(handle, &symEntries[index], name))
+            return &symEntries[index];
+
+        if (chainHash & 1)
+            break;
+
+        ++index;
     }
 
     return NULL;
 }
 
+const Elf32_Sym* ctrdl_unsafeFindSymbolFromName(CTRDLHandle* handle, const char* name) {
+    // Tables aren't published until the object is relocated.
+    const Elf32_Sym* symEntries = __atomic_load_n(&handle->symEntries, __ATOMIC_ACQUIRE);
+    if (!symEntries)
+        return NULL;
+
+    if (handle->hasGNUHash)
+        return ctrdl_findSymbolGNU(handle, symEntries, name, ctrdl_getELFGNUSymNameHash(name));
+
+    return ctrdl_findSymbolSysV(handle, symEntries, name, ctrdl_getELFSymNameHash(name));
+}
+
+const Elf32_Sym* ctrdl_findSymbolHashed(CTRDLHandle* handle, const char* name, Elf32_Word gnuHash, Elf32_Word sysvHash) {
+    const Elf32_Sym* symEntries = __atomic_load_n(&handle->symEntries, __ATOMIC_ACQUIRE);
+    if (!symEntries)
+        return NULL;
+
+    return handle->hasGNUHash ? ctrdl_findSymbolGNU(handle, symEntries, name, gnuHash) : ctrdl_findSymbolSysV(handle, symEntries, name, sysvHash);
+}
+
 const Elf32_Sym* ctrdl_findSymbolFromName(CTRDLHandle* handle, const char* name) {
     const Elf32_Sym* found = NULL;
 
     if (handle) {
         ctrdl_lockHandle(handle);
+        found = ctrdl_unsafeFindSymbolFromName(handle, name);
+        ctrdl_unlockHandle(handle);
+    }
 
-        const Elf32_Word hash = ctrdl_getELFSymNameHash(name);
-        size_t chainIndex = handle->symBuckets[hash % handle->numSymBuckets];
+    return found;
+}
 
-        while (chainIndex != STN_UNDEF) {
-            const Elf32_Sym* sym = &handle->symEntries[chainIndex];
-            if (!strcmp(&handle->stringTable[sym->st_name], name)) {
-                found = sym;
-                break;
+bool ctrdl_buildLookupScope(CTRDLHandle* handle) {
+    // Breadth first, each object appears once.
+    size_t capacity = handle->numDeps + 1;
+    CTRDLHandle** scope = malloc(capacity * sizeof(CTRDLHandle*));
+    if (!scope) {
+        ctrdl_setLastError(Err_NoMemory);
+        return false;
+    }
+
+    size_t size = 0;
+    scope[size++] = handle;
+
+    for (size_t i = 0; i < size; ++i) {
+        const CTRDLHandle* h = scope[i];
+        for (size_t j = 0; j < h->numDeps; ++j) {
+            CTRDLHandle* dep = h->deps[j];
+
+            bool visited = false;
+            for (size_t k = 0; k < size; ++k) {
+                if (scope[k] == dep) {
+                    visited = true;
+                    break;
+                }
             }
 
-            chainIndex = handle->symChains[chainIndex];
+            if (visited)
+                continue;
+
+            if (size >= capacity) {
+                capacity *= 2;
+                CTRDLHandle** newScope = realloc(scope, capacity * sizeof(CTRDLHandle*));
+                if (!newScope) {
+                    ctrdl_setLastError(Err_NoMemory);
+                    free(scope);
+                    return false;
+                }
+
+                scope = newScope;
+            }
+
+            scope[size++] = dep;
         }
+    }
 
-        ctrdl_unlockHandle(handle);
+    handle->scope = scope;
+    handle->scopeSize = size;
+
+    // The SysV hash is only computed if some object needs it.
+    handle->scopeNeedsSysVHash = false;
+    for (size_t i = 0; i < size; ++i) {
+        if (!scope[i]->hasGNUHash)
+            handle->scopeNeedsSysVHash = true;
     }
 
-    return found;
+    return true;
+}
+
+const Elf32_Sym* ctrdl_extendedFindSymbolFromName(CTRDLHandle* handle, const char* name, CTRDLHandle** owner) {
+    return ctrdl_hashedFindSymbolFromName(handle, name, ctrdl_getELFGNUSymNameHash(name), owner);
 }
 
-const Elf32_Sym* ctrdl_extendedFindSymbolFromName(CTRDLHandle* handle, const char* name) {
-    DepQueue q;
+const Elf32_Sym* ctrdl_hashedFindSymbolFromName(CTRDLHandle* handle, const char* name, Elf32_Word gnuHash, CTRDLHandle** owner) {
     const Elf32_Sym* found = NULL;
 
     if (handle) {
         ctrdl_lockHandle(handle);
 
-        ctrdl_depQueueInit(&q);
-        ctrdl_depQueuePush(&q, handle);
+        const Elf32_Word sysvHash = handle->scopeNeedsSysVHash ? ctrdl_getELFSymNameHash(name) : 0;
 
-        while (!ctrdl_depQueueIsEmpty(&q)) {
-            CTRDLHandle* h = ctrdl_depQueuePop(&q);
-            found = ctrdl_findSymbolFromName(h, name);
-            if (found)
-                break;
+        // Dependencies are kept alive by the reference on the handle.
+        for (size_t i = 0; i < handle->scopeSize; ++i) {
+            CTRDLHandle* h = handle->scope[i];
+            found = ctrdl_findSymbolHashed(h, name, gnuHash, sysvHash);
+            if (found) {
+                if (owner)
+                    *owner = h;
 
-            for (size_t i = 0; i < CTRDL_MAX_DEPS; ++i)
-                ctrdl_depQueuePush(&q, h->deps[i]);
+                break;
+            }
         }
 
         ctrdl_unlockHandle(handle);
@@ -88,25 +167,110 @@ const Elf32_Sym* ctrdl_extendedFindSymbolFromName(CTRDLHandle* handle, const cha
     return found;
 }
 
-const Elf32_Sym* ctrdl_findSymbolFromValue(CTRDLHandle* handle, Elf32_Word value) {
-    const Elf32_Sym* found = NULL;
+static int ctrdl_compareAddrEntries(const void* a, const void* b) {
+    const CTRDLAddrEntry* x = a;
+    const CTRDLAddrEntry* y = b;
 
-    if (handle) {
-        ctrdl_lockHandle(handle);
+    if (x->addr != y->addr)
+        return (x->addr < y->addr) ? -1 : 1;
 
-        for (size_t i = 0; i < handle->numSymChains; ++i) {
-            if (i == STN_UNDEF)
-                continue;
+    // Larger symbols first, so that the last match is the innermost one.
+    return (x->size > y->size) ? -1 : (x->size < y->size);
+}
 
-            const Elf32_Sym* sym = &handle->symEntries[i];
-            if ((sym->st_value >= value) && (value < (sym->st_value + sym->st_size))) {
-                found = sym;
-                break;
+static bool ctrdl_buildAddrIndex(CTRDLHandle* handle) {
+    size_t count = 0;
+    for (size_t i = 1; i < handle->numSymChains; ++i) {
+        const Elf32_Sym* sym = &handle->symEntries[i];
+        const u8 type = ELF32_ST_TYPE(sym->st_info);
+        if ((sym->st_shndx != SHN_UNDEF) && ((type == STT_FUNC) || (type == STT_OBJECT)))
+            ++count;
+    }
+
+    CTRDLAddrEntry* entries = malloc((count ? count : 1) * sizeof(CTRDLAddrEntry));
+    if (!entries) {
+        ctrdl_setLastError(Err_NoMemory);
+        return false;
+    }
+
+    size_t index = 0;
+    for (size_t i = 1; i < handle->numSymChains; ++i) {
+        const Elf32_Sym* sym = &handle->symEntries[i];
+        const u8 type = ELF32_ST_TYPE(sym->st_info);
+        if ((sym->st_shndx != SHN_UNDEF) && ((type == STT_FUNC) || (type == STT_OBJECT))) {
+            // The low bit of Thumb function addresses is not part of the address.
+            entries[index].addr = (type == STT_FUNC) ? (sym->st_value & ~1u) : sym->st_value;
+            entries[index].size = sym->st_size;
+            entries[index].sym = sym;
+            ++index;
+        }
+    }
+
+    qsort(entries, count, sizeof(CTRDLAddrEntry), ctrdl_compareAddrEntries);
+    handle->numAddrEntries = count;
+    __atomic_store_n(&handle->addrIndex, entries, __ATOMIC_RELEASE);
+    return true;
+}
+
+const Elf32_Sym* ctrdl_findSymbolFromValueWithCursor(CTRDLHandle* handle, Elf32_Word value, size_t* cursor) {
+    // Built on first use under the mutex, read only afterwards.
+    const CTRDLAddrEntry* entries = __atomic_load_n(&handle->addrIndex, __ATOMIC_ACQUIRE);
+    if (!entries) {
+        // Still loading, an index built now would be empty for good.
+        if (!__atomic_load_n(&handle->symEntries, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        ctrdl_acquireHandleMtx();
+        if (handle->addrIndex || ctrdl_buildAddrIndex(handle))
+            entries = handle->addrIndex;
+        ctrdl_releaseHandleMtx();
+
+        if (!entries)
+            return NULL;
+    }
+
+    // Find the last symbol starting at or before the value.
+    size_t low = 0;
+    if (cursor) {
+        // Values are increasing, continue from the previous position.
+        low = *cursor;
+        while ((low < handle->numAddrEntries) && (entries[low].addr <= value))
+            ++low;
+
+        *cursor = low;
+    } else {
+        size_t high = handle->numAddrEntries;
+        while (low < high) {
+            const size_t mid = low + ((high - low) / 2);
+            if (entries[mid].addr <= value) {
+                low = mid + 1;
+            } else {
+                high = mid;
             }
         }
+    }
+
+    if (!low)
+        return NULL;
+
+    // Prefer a symbol which contains the value, otherwise the nearest preceding one.
+    const u32 start = entries[low - 1].addr;
+    for (size_t i = low; (i > 0) && (entries[i - 1].addr == start); --i) {
+        if ((value - start) < entries[i - 1].size)
+            return entries[i - 1].sym;
+    }
 
+    return entries[low - 1].sym;
+}
+
+const Elf32_Sym* ctrdl_findSymbolFromValue(CTRDLHandle* handle, Elf32_Word value) {
+    const Elf32_Sym* found = NULL;
+
+    if (handle) {
+        ctrdl_lockHandle(handle);
+        found = ctrdl_findSymbolFromValueWithCursor(handle, value, NULL);
         ctrdl_unlockHandle(handle);
     }
 
     return found;
-}
\ No newline at end of file
+}
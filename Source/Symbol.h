@@ -3,8 +3,15 @@
 
 #include "Handle.h"
 
+const Elf32_Sym* ctrdl_unsafeFindSymbolFromName(CTRDLHandle* handle, const char* name);
 const Elf32_Sym* ctrdl_findSymbolFromName(CTRDLHandle* handle, const char* name);
-const Elf32_Sym* ctrdl_extendedFindSymbolFromName(CTRDLHandle* handle, const char* name);
+const Elf32_Sym* ctrdl_findSymbolHashed(CTRDLHandle* handle, const char* name, Elf32_Word gnuHash, Elf32_Word sysvHash);
+// Flattened dependency graph searched by ctrdl_extendedFindSymbolFromName.
+bool ctrdl_buildLookupScope(CTRDLHandle* handle);
+const Elf32_Sym* ctrdl_extendedFindSymbolFromName(CTRDLHandle* handle, const char* name, CTRDLHandle** owner);
+const Elf32_Sym* ctrdl_hashedFindSymbolFromName(CTRDLHandle* handle, const char* name, Elf32_Word gnuHash, CTRDLHandle** owner);
+// Cursor is optional, when given values must be passed in increasing order.
+const Elf32_Sym* ctrdl_findSymbolFromValueWithCursor(CTRDLHandle* handle, Elf32_Word value, size_t* cursor);
 const Elf32_Sym* ctrdl_findSymbolFromValue(CTRDLHandle* handle, Elf32_Word value);
 
 #endif /* _CTRDL_SYMBOL_H */
\ No newline at end of file
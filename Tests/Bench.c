@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+
+#include "ELFBuilder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_EXPORTS 2000
+#define NUM_IMPORTS 300
+#define NUM_RELATIVE 20000
+#define NUM_SYMBOLIC 4000
+#define NUM_ITERATIONS 50
+
+static char g_Dir[] = "/tmp/ctrdl-bench-XXXXXX";
+static char g_Path[256];
+static int g_Mode = RTLD_NOW;
+static char g_Names[NUM_EXPORTS + NUM_IMPORTS][32];
+
+static u64 nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* resolver(const char* sym, void* unused) {
+    // Imports are named "import<N>".
+    return (void*)(uintptr_t)(0x10000000 + atoi(sym + 6) * 4);
+}
+
+static bool writeObject(int argc, char* argv[]) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--gnu-hash"))
+            b.hashStyle = ELF_HASH_GNU;
+        else if (!strcmp(argv[i], "--relr"))
+            b.packing = ELF_PACK_RELR;
+        else if (!strcmp(argv[i], "--android-packed"))
+            b.packing = ELF_PACK_ANDROID;
+        else if (!strcmp(argv[i], "--relocs-after-image"))
+            b.relocsAfterImage = true;
+        else if (!strcmp(argv[i], "--lazy"))
+            g_Mode = RTLD_LAZY;
+    }
+
+    const uint32_t func = elfBuilderText(&b, NUM_EXPORTS * 16);
+    const uint32_t table = elfBuilderData(&b, NULL, NUM_EXPORTS * 4);
+
+    for (size_t i = 0; i < NUM_EXPORTS; ++i) {
+        snprintf(g_Names[i], sizeof(g_Names[i]), "export%zu", i);
+        elfBuilderExport(&b, g_Names[i], ELF_TEXT(func + i * 16), 16, STT_FUNC);
+    }
+
+    uint32_t imports[NUM_IMPORTS];
+    for (size_t i = 0; i < NUM_IMPORTS; ++i) {
+        char* name = g_Names[NUM_EXPORTS + i];
+        snprintf(name, sizeof(g_Names[0]), "import%zu", i);
+        imports[i] = elfBuilderImport(&b, name);
+    }
+
+    const uint32_t relative = elfBuilderData(&b, NULL, NUM_RELATIVE * 4);
+    for (size_t i = 0; i < NUM_RELATIVE; ++i)
+        elfBuilderRelative(&b, relative + i * 4, ELF_DATA(table + (i % NUM_EXPORTS) * 4));
+
+    const uint32_t symbolic = elfBuilderData(&b, NULL, NUM_SYMBOLIC * 4);
+    for (size_t i = 0; i < NUM_SYMBOLIC; ++i) {
+        const uint8_t type = (i & 1) ? R_ARM_JUMP_SLOT : R_ARM_GLOB_DAT;
+        elfBuilderSymbolic(&b, symbolic + i * 4, type, imports[i % NUM_IMPORTS], 0);
+    }
+
+    snprintf(g_Path, sizeof(g_Path), "%s/Bench.so", g_Dir);
+    const bool ret = elfBuilderWrite(&b, g_Path);
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static void report(const char* what, u64 elapsed, size_t count) {
+    printf("%-24s %10.1f ns/op (%zu ops)\n", what, (double)elapsed / count, count);
+}
+
+int main(int argc, char* argv[]) {
+    if (!mkdtemp(g_Dir) || !writeObject(argc, argv)) {
+        printf("Could not write bench object\n");
+        return 1;
+    }
+
+    // Load/unload.
+    u64 start = nowNs();
+    for (size_t i = 0; i < NUM_ITERATIONS; ++i) {
+        void* h = ctrdlOpen(g_Path, g_Mode, resolver, NULL);
+        if (!h) {
+            printf("ctrdlOpen() failed: %s\n", dlerror());
+            return 1;
+        }
+
+        dlclose(h);
+    }
+    report("dlopen+dlclose", nowNs() - start, NUM_ITERATIONS);
+
+    CTRDLSpaceStats spaceStats;
+    if (ctrdlSpaceStats(&spaceStats))
+        printf("%-24s %10zu free ranges, %zu stale, %zu fallbacks\n", "mirror space", spaceStats.numFreeRanges, spaceStats.numStale, spaceStats.numFallbacks);
+
+    void* h = ctrdlOpen(g_Path, g_Mode, resolver, NULL);
+    if (!h) {
+        printf("ctrdlOpen() failed: %s\n", dlerror());
+        return 1;
+    }
+
+    CTRDLInfo info;
+    if (ctrdlInfo(h, &info)) {
+        printf("%-24s %10zu bytes, %zu saved\n", "image size", info.size, info.savedSize);
+        printf("%-24s %10zu bytes, %zu reads, %zu seeks\n", "load I/O", info.bytesRead, info.numReads, info.numSeeks);
+        printf("%-24s %10zu hits, %zu misses\n", "load symbol cache", info.symCacheHits, info.symCacheMisses);
+        printf("%-24s %10zu lazy, %zu bound\n", "PLT slots", info.numLazySlots, info.numBoundSlots);
+        ctrdlFreeInfo(&info);
+    }
+
+    // Positive lookups.
+    void* addrs[NUM_EXPORTS];
+    start = nowNs();
+    for (size_t i = 0; i < NUM_EXPORTS; ++i)
+        addrs[i] = dlsym(h, g_Names[i]);
+    report("dlsym (hit)", nowNs() - start, NUM_EXPORTS);
+
+    const char* batchNames[NUM_EXPORTS];
+    for (size_t i = 0; i < NUM_EXPORTS; ++i)
+        batchNames[i] = g_Names[i];
+
+    void* batchOut[NUM_EXPORTS];
+    start = nowNs();
+    ctrdlSymBatch(h, batchNames, NUM_EXPORTS, batchOut);
+    report("ctrdlSymBatch", nowNs() - start, NUM_EXPORTS);
+
+    // Repeated lookups, served by the dlsym cache.
+    start = nowNs();
+    for (size_t i = 0; i < NUM_EXPORTS; ++i)
+        dlsym(h, g_Names[i % 16]);
+    report("dlsym (repeated)", nowNs() - start, NUM_EXPORTS);
+
+    CTRDLSymCacheStats cacheStats;
+    ctrdlSymCacheStats(&cacheStats);
+    printf("%-24s %10zu hits, %zu misses\n", "dlsym cache", cacheStats.hits, cacheStats.misses);
+
+    // Negative lookups.
+    start = nowNs();
+    for (size_t i = 0; i < NUM_IMPORTS; ++i)
+        dlsym(h, g_Names[NUM_EXPORTS + i]);
+    report("dlsym (miss)", nowNs() - start, NUM_IMPORTS);
+
+    // Address lookups.
+    Dl_info symInfo;
+    start = nowNs();
+    for (size_t i = 0; i < NUM_EXPORTS; ++i)
+        dladdr(addrs[i], &symInfo);
+    report("dladdr", nowNs() - start, NUM_EXPORTS);
+
+    u32 batchAddrs[NUM_EXPORTS];
+    for (size_t i = 0; i < NUM_EXPORTS; ++i)
+        batchAddrs[NUM_EXPORTS - i - 1] = (u32)(uintptr_t)addrs[i];
+
+    Dl_info batchInfo[NUM_EXPORTS];
+    start = nowNs();
+    ctrdlSymbolizeBatch(batchAddrs, NUM_EXPORTS, batchInfo);
+    report("ctrdlSymbolizeBatch", nowNs() - start, NUM_EXPORTS);
+
+    dlclose(h);
+    unlink(g_Path);
+    rmdir(g_Dir);
+    return 0;
+}
@@ -0,0 +1,752 @@
+#include "ELFBuilder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE 0x1000
+#define NUM_PHDRS 3
+
+// Where a relocation ends up.
+#define RELOC_DYN 0
+#define RELOC_PLT 1
+#define RELOC_RELR 2
+#define RELOC_PACKED 3
+
+// Android packed relocation group flags.
+#define APS2_GROUPED_BY_INFO 0x1
+#define APS2_GROUP_HAS_ADDEND 0x8
+
+#ifndef DT_RELR
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#define DT_RELRENT 37
+#endif
+
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL 0x6000000F
+#define DT_ANDROID_RELSZ 0x60000010
+#define DT_ANDROID_RELA 0x60000011
+#define DT_ANDROID_RELASZ 0x60000012
+#endif
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+} Buffer;
+
+static void* growArray(void* array, size_t count, size_t elemSize) {
+    // Grow in powers of two.
+    if (count & (count - 1))
+        return array;
+
+    void* p = realloc(array, (count ? count * 2 : 1) * elemSize);
+    if (!p)
+        abort();
+
+    return p;
+}
+
+static uint32_t bufferAppend(Buffer* buf, const void* data, size_t size) {
+    const uint32_t offset = buf->size;
+    uint8_t* p = realloc(buf->data, buf->size + size);
+    if (!p)
+        abort();
+
+    if (data) {
+        memcpy(p + buf->size, data, size);
+    } else {
+        memset(p + buf->size, 0, size);
+    }
+
+    buf->data = p;
+    buf->size += size;
+    return offset;
+}
+
+static void bufferAlign(Buffer* buf, size_t alignment) {
+    const size_t aligned = (buf->size + alignment - 1) & ~(alignment - 1);
+    if (aligned != buf->size)
+        bufferAppend(buf, NULL, aligned - buf->size);
+}
+
+static uint32_t sysvHash(const char* name) {
+    uint32_t h = 0;
+
+    while (*name) {
+        h = (h << 4) + (uint8_t)*name++;
+        const uint32_t g = h & 0xF0000000;
+        if (g)
+            h ^= g >> 24;
+
+        h &= ~g;
+    }
+
+    return h;
+}
+
+static uint32_t gnuHash(const char* name) {
+    uint32_t h = 5381;
+
+    while (*name)
+        h = (h << 5) + h + (uint8_t)*name++;
+
+    return h;
+}
+
+void elfBuilderInit(ELFBuilder* b) {
+    memset(b, 0, sizeof(ELFBuilder));
+
+    // Index 0 is STN_UNDEF.
+    b->syms = growArray(b->syms, b->numSyms, sizeof(ELFBuilderSym));
+    memset(&b->syms[b->numSyms++], 0, sizeof(ELFBuilderSym));
+    b->hashStyle = ELF_HASH_SYSV;
+    b->relCount = true;
+    b->packing = ELF_PACK_NONE;
+}
+
+void elfBuilderFree(ELFBuilder* b) {
+    free(b->text);
+    free(b->data);
+    free(b->syms);
+    free(b->relocs);
+    free(b->needed);
+}
+
+uint32_t elfBuilderText(ELFBuilder* b, size_t size) {
+    Buffer buf = { b->text, b->textSize };
+    bufferAlign(&buf, 4);
+    const uint32_t offset = bufferAppend(&buf, NULL, size);
+
+    // Fill with "bx lr".
+    for (size_t i = offset; (i + 4) <= buf.size; i += 4) {
+        const uint32_t insn = 0xE12FFF1E;
+        memcpy(&buf.data[i], &insn, sizeof(insn));
+    }
+
+    b->text = buf.data;
+    b->textSize = buf.size;
+    return offset;
+}
+
+uint32_t elfBuilderData(ELFBuilder* b, const void* data, size_t size) {
+    Buffer buf = { b->data, b->dataSize };
+    bufferAlign(&buf, 4);
+    const uint32_t offset = bufferAppend(&buf, data, size);
+    b->data = buf.data;
+    b->dataSize = buf.size;
+    return offset;
+}
+
+uint32_t elfBuilderWord(ELFBuilder* b, uint32_t value) { return elfBuilderData(b, &value, sizeof(value)); }
+void elfBuilderBss(ELFBuilder* b, size_t size) { b->bssSize += size; }
+
+static uint32_t addSym(ELFBuilder* b, const char* name, ELFLoc loc, uint32_t size, uint8_t type, bool defined) {
+    b->syms = growArray(b->syms, b->numSyms, sizeof(ELFBuilderSym));
+    ELFBuilderSym* sym = &b->syms[b->numSyms];
+    sym->name = name;
+    sym->loc = loc;
+    sym->size = size;
+    sym->type = type;
+    sym->defined = defined;
+    return b->numSyms++;
+}
+
+uint32_t elfBuilderExport(ELFBuilder* b, const char* name, ELFLoc loc, uint32_t size, uint8_t type) {
+    return addSym(b, name, loc, size, type, true);
+}
+
+uint32_t elfBuilderImport(ELFBuilder* b, const char* name) { return addSym(b, name, ELF_TEXT(0), 0, STT_NOTYPE, false); }
+
+void elfBuilderNeeded(ELFBuilder* b, const char* name) {
+    b->needed = growArray(b->needed, b->numNeeded, sizeof(const char*));
+    b->needed[b->numNeeded++] = name;
+}
+
+static ELFBuilderReloc* addReloc(ELFBuilder* b) {
+    b->relocs = growArray(b->relocs, b->numRelocs, sizeof(ELFBuilderReloc));
+    ELFBuilderReloc* r = &b->relocs[b->numRelocs++];
+    memset(r, 0, sizeof(ELFBuilderReloc));
+    return r;
+}
+
+void elfBuilderRelative(ELFBuilder* b, uint32_t offset, ELFLoc target) {
+    ELFBuilderReloc* r = addReloc(b);
+    r->offset = offset;
+    r->type = R_ARM_RELATIVE;
+    r->target = target;
+}
+
+void elfBuilderSymbolic(ELFBuilder* b, uint32_t offset, uint8_t type, uint32_t sym, int32_t addend) {
+    if ((type == R_ARM_JUMP_SLOT) && !b->hasPlt) {
+        // PLT0 as emitted by ld, followed by the GOT offset.
+        const uint32_t plt0[] = { 0xE52DE004, 0xE59FE004, 0xE08FE00E, 0xE5BEF008, 0 };
+        b->plt0 = elfBuilderText(b, sizeof(plt0));
+        memcpy(&b->text[b->plt0], plt0, sizeof(plt0));
+
+        // GOT[0] is the dynamic section, GOT[1] and GOT[2] are set by the loader.
+        b->pltGot = elfBuilderData(b, NULL, 3 * sizeof(uint32_t));
+        b->hasPlt = true;
+    }
+
+    ELFBuilderReloc* r = addReloc(b);
+    r->offset = offset;
+    r->type = type;
+    r->sym = sym;
+    r->addend = addend;
+    r->plt = type == R_ARM_JUMP_SLOT;
+}
+
+uint32_t elfBuilderVAddr(const ELFBuilder* b, ELFLoc loc) {
+    return loc.offset + ((loc.segment == ELF_SEG_TEXT) ? b->textVAddr : b->dataVAddr);
+}
+
+static uint8_t relocKind(const ELFBuilder* b, const ELFBuilderReloc* r) {
+    if (r->plt)
+        return RELOC_PLT;
+
+    if ((b->packing == ELF_PACK_RELR) && (r->type == R_ARM_RELATIVE))
+        return RELOC_RELR;
+
+    if (b->packing == ELF_PACK_ANDROID)
+        return RELOC_PACKED;
+
+    return RELOC_DYN;
+}
+
+static int32_t relocAddend(const ELFBuilder* b, const ELFBuilderReloc* r) {
+    return (r->type == R_ARM_RELATIVE) ? (int32_t)elfBuilderVAddr(b, r->target) : r->addend;
+}
+
+static int compareOffsets(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a;
+    const uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Encodes data offsets of relative relocations, addresses are patched once the layout is known.
+static void encodeRelr(const ELFBuilder* b, Buffer* out) {
+    uint32_t* offsets = calloc(b->numRelocs + 1, sizeof(uint32_t));
+    if (!offsets)
+        abort();
+
+    size_t count = 0;
+    for (size_t i = 0; i < b->numRelocs; ++i) {
+        if (relocKind(b, &b->relocs[i]) == RELOC_RELR)
+            offsets[count++] = b->relocs[i].offset;
+    }
+
+    qsort(offsets, count, sizeof(uint32_t), compareOffsets);
+
+    size_t i = 0;
+    while (i < count) {
+        bufferAppend(out, &offsets[i], sizeof(uint32_t));
+        uint32_t where = offsets[i++] + 4;
+
+        while (true) {
+            uint32_t bitmap = 0;
+            while ((i < count) && (offsets[i] >= where) && ((offsets[i] - where) < (31 * 4))) {
+                bitmap |= 1u << ((offsets[i] - where) / 4);
+                ++i;
+            }
+
+            if (!bitmap)
+                break;
+
+            const uint32_t entry = (bitmap << 1) | 1;
+            bufferAppend(out, &entry, sizeof(uint32_t));
+            where += 31 * 4;
+        }
+    }
+
+    free(offsets);
+}
+
+static void bufferSLEB128(Buffer* buf, int32_t value) {
+    bool more = true;
+
+    while (more) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+
+        if (((value == 0) && !(byte & 0x40)) || ((value == -1) && (byte & 0x40))) {
+            more = false;
+        } else {
+            byte |= 0x80;
+        }
+
+        bufferAppend(buf, &byte, 1);
+    }
+}
+
+// Worst case size of the packed table, so that it can be reserved before the layout is known.
+static size_t packedReserve(size_t count) { return 4 + (2 * 5) + (count * 5 * 5); }
+
+// Runs of relocations with the same info share a group.
+static void encodePacked(const ELFBuilder* b, Buffer* out, const uint32_t* symIndices) {
+    size_t count = 0;
+    for (size_t i = 0; i < b->numRelocs; ++i) {
+        if (relocKind(b, &b->relocs[i]) == RELOC_PACKED)
+            ++count;
+    }
+
+    bufferAppend(out, "APS2", 4);
+    bufferSLEB128(out, count);
+    bufferSLEB128(out, 0);
+
+    uint32_t prevOffset = 0;
+    int32_t prevAddend = 0;
+    size_t i = 0;
+    while (i < b->numRelocs) {
+        const ELFBuilderReloc* r = &b->relocs[i];
+        if (relocKind(b, r) != RELOC_PACKED) {
+            ++i;
+            continue;
+        }
+
+        const uint32_t info = ELF32_R_INFO(symIndices[r->sym], r->type);
+        size_t end = i;
+        size_t groupSize = 0;
+        while (end < b->numRelocs) {
+            const ELFBuilderReloc* next = &b->relocs[end];
+            if (relocKind(b, next) == RELOC_PACKED) {
+                if (ELF32_R_INFO(symIndices[next->sym], next->type) != info)
+                    break;
+
+                ++groupSize;
+            }
+
+            ++end;
+        }
+
+        bufferSLEB128(out, groupSize);
+        bufferSLEB128(out, APS2_GROUPED_BY_INFO | (b->useRela ? APS2_GROUP_HAS_ADDEND : 0));
+        bufferSLEB128(out, info);
+
+        for (; i < end; ++i) {
+            const ELFBuilderReloc* next = &b->relocs[i];
+            if (relocKind(b, next) != RELOC_PACKED)
+                continue;
+
+            const uint32_t offset = elfBuilderVAddr(b, ELF_DATA(next->offset));
+            bufferSLEB128(out, (int32_t)(offset - prevOffset));
+            prevOffset = offset;
+
+            if (b->useRela) {
+                const int32_t addend = relocAddend(b, next);
+                bufferSLEB128(out, addend - prevAddend);
+                prevAddend = addend;
+            }
+        }
+    }
+}
+
+static void writeReloc(ELFBuilder* b, Buffer* out, const ELFBuilderReloc* r, const uint32_t* symIndices) {
+    const uint32_t offset = elfBuilderVAddr(b, ELF_DATA(r->offset));
+    const uint32_t info = ELF32_R_INFO(symIndices[r->sym], r->type);
+
+    if (b->useRela) {
+        Elf32_Rela rela;
+        rela.r_offset = offset;
+        rela.r_info = info;
+        rela.r_addend = relocAddend(b, r);
+        bufferAppend(out, &rela, sizeof(rela));
+    } else {
+        Elf32_Rel rel;
+        rel.r_offset = offset;
+        rel.r_info = info;
+        bufferAppend(out, &rel, sizeof(rel));
+    }
+}
+
+static void addDyn(Buffer* dyn, Elf32_Sword tag, Elf32_Word value) {
+    Elf32_Dyn d;
+    d.d_tag = tag;
+    d.d_un.d_val = value;
+    bufferAppend(dyn, &d, sizeof(d));
+}
+
+bool elfBuilderBuild(ELFBuilder* b, uint8_t** out, size_t* outSize) {
+    Buffer file = {};
+    Buffer strtab = {};
+    bufferAppend(&strtab, "", 1);
+
+    uint32_t* nameOffsets = calloc(b->numSyms, sizeof(uint32_t));
+    uint32_t* neededOffsets = calloc(b->numNeeded + 1, sizeof(uint32_t));
+    if (!nameOffsets || !neededOffsets)
+        abort();
+
+    for (size_t i = 1; i < b->numSyms; ++i)
+        nameOffsets[i] = bufferAppend(&strtab, b->syms[i].name, strlen(b->syms[i].name) + 1);
+
+    // Symbol order, GNU hash needs undefined symbols first and the rest sorted by bucket.
+    uint32_t* order = calloc(b->numSyms, sizeof(uint32_t));
+    uint32_t* symIndices = calloc(b->numSyms, sizeof(uint32_t));
+    uint32_t* hashes = calloc(b->numSyms, sizeof(uint32_t));
+    if (!order || !symIndices || !hashes)
+        abort();
+
+    size_t numOrdered = 1;
+    uint32_t symOffset = 1;
+    uint32_t numGNUBuckets = 1;
+    if (b->hashStyle & ELF_HASH_GNU) {
+        for (size_t i = 1; i < b->numSyms; ++i) {
+            hashes[i] = gnuHash(b->syms[i].name);
+            if (!b->syms[i].defined)
+                order[numOrdered++] = i;
+        }
+
+        symOffset = numOrdered;
+        numGNUBuckets = ((b->numSyms - symOffset) / 4) + 1;
+        for (size_t bucket = 0; bucket < numGNUBuckets; ++bucket) {
+            for (size_t i = 1; i < b->numSyms; ++i) {
+                if (b->syms[i].defined && ((hashes[i] % numGNUBuckets) == bucket))
+                    order[numOrdered++] = i;
+            }
+        }
+    } else {
+        for (size_t i = 1; i < b->numSyms; ++i)
+            order[numOrdered++] = i;
+    }
+
+    for (size_t i = 0; i < b->numSyms; ++i)
+        symIndices[order[i]] = i;
+
+    for (size_t i = 0; i < b->numNeeded; ++i)
+        neededOffsets[i] = bufferAppend(&strtab, b->needed[i], strlen(b->needed[i]) + 1);
+
+    // Headers, patched at the end.
+    bufferAppend(&file, NULL, sizeof(Elf32_Ehdr) + NUM_PHDRS * sizeof(Elf32_Phdr));
+
+    // SysV hash table.
+    uint32_t hashOffset = 0;
+    if (b->hashStyle & ELF_HASH_SYSV) {
+        const uint32_t numBuckets = (b->numSyms / 2) + 1;
+        uint32_t* buckets = calloc(numBuckets, sizeof(uint32_t));
+        uint32_t* chains = calloc(b->numSyms, sizeof(uint32_t));
+        if (!buckets || !chains)
+            abort();
+
+        for (size_t i = 1; i < b->numSyms; ++i) {
+            const uint32_t bucket = sysvHash(b->syms[order[i]].name) % numBuckets;
+            chains[i] = buckets[bucket];
+            buckets[bucket] = i;
+        }
+
+        bufferAlign(&file, 4);
+        hashOffset = bufferAppend(&file, &numBuckets, sizeof(uint32_t));
+        const uint32_t numChains = b->numSyms;
+        bufferAppend(&file, &numChains, sizeof(uint32_t));
+        bufferAppend(&file, buckets, numBuckets * sizeof(uint32_t));
+        bufferAppend(&file, chains, b->numSyms * sizeof(uint32_t));
+        free(buckets);
+        free(chains);
+    }
+
+    // GNU hash table.
+    uint32_t gnuHashOffset = 0;
+    if (b->hashStyle & ELF_HASH_GNU) {
+        const uint32_t numHashed = b->numSyms - symOffset;
+        const uint32_t bloomShift = 6;
+        uint32_t bloomSize = 1;
+        while ((bloomSize * 32) < (numHashed * 8))
+            bloomSize *= 2;
+
+        uint32_t* bloom = calloc(bloomSize, sizeof(uint32_t));
+        uint32_t* buckets = calloc(numGNUBuckets, sizeof(uint32_t));
+        uint32_t* chains = calloc(numHashed + 1, sizeof(uint32_t));
+        if (!bloom || !buckets || !chains)
+            abort();
+
+        for (size_t i = symOffset; i < b->numSyms; ++i) {
+            const uint32_t h = hashes[order[i]];
+            const uint32_t bucket = h % numGNUBuckets;
+            bloom[(h / 32) & (bloomSize - 1)] |= (1u << (h % 32)) | (1u << ((h >> bloomShift) % 32));
+
+            if (!buckets[bucket])
+                buckets[bucket] = i;
+
+            const bool last = ((i + 1) == b->numSyms) || ((hashes[order[i + 1]] % numGNUBuckets) != bucket);
+            chains[i - symOffset] = (h & ~1u) | (last ? 1 : 0);
+        }
+
+        const uint32_t header[4] = { numGNUBuckets, symOffset, bloomSize, bloomShift };
+        bufferAlign(&file, 4);
+        gnuHashOffset = bufferAppend(&file, header, sizeof(header));
+        bufferAppend(&file, bloom, bloomSize * sizeof(uint32_t));
+        bufferAppend(&file, buckets, numGNUBuckets * sizeof(uint32_t));
+        bufferAppend(&file, chains, numHashed * sizeof(uint32_t));
+        free(bloom);
+        free(buckets);
+        free(chains);
+    }
+
+    // Symbol table, values are patched once the layout is known.
+    const uint32_t symtabOffset = bufferAppend(&file, NULL, b->numSyms * sizeof(Elf32_Sym));
+
+    // String table.
+    const uint32_t strtabOffset = bufferAppend(&file, strtab.data, strtab.size);
+    bufferAlign(&file, 4);
+
+    // Relocations, written once the layout is known.
+    size_t numDynRelocs = 0;
+    size_t numPltRelocs = 0;
+    size_t numRelative = 0;
+    size_t numPacked = 0;
+    for (size_t i = 0; i < b->numRelocs; ++i) {
+        switch (relocKind(b, &b->relocs[i])) {
+            case RELOC_PLT:
+                ++numPltRelocs;
+                break;
+            case RELOC_PACKED:
+                ++numPacked;
+                break;
+            case RELOC_DYN:
+                ++numDynRelocs;
+
+                if (b->relocs[i].type == R_ARM_RELATIVE)
+                    ++numRelative;
+                break;
+        }
+    }
+
+    const size_t relocSize = b->useRela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+    uint32_t dynRelocsOffset = 0;
+    uint32_t pltRelocsOffset = 0;
+    if (!b->relocsAfterImage) {
+        dynRelocsOffset = bufferAppend(&file, NULL, numDynRelocs * relocSize);
+        pltRelocsOffset = bufferAppend(&file, NULL, numPltRelocs * relocSize);
+    }
+
+    Buffer relr = {};
+    encodeRelr(b, &relr);
+    const uint32_t relrOffset = bufferAppend(&file, NULL, relr.size);
+
+    const size_t packedSize = numPacked ? packedReserve(numPacked) : 0;
+    const uint32_t packedOffset = bufferAppend(&file, NULL, packedSize);
+
+    // Text.
+    bufferAlign(&file, 16);
+    b->textVAddr = bufferAppend(&file, b->text, b->textSize);
+    const uint32_t textEnd = file.size;
+
+    // Data, followed by the dynamic section.
+    bufferAlign(&file, PAGE_SIZE);
+    b->dataVAddr = bufferAppend(&file, b->data, b->dataSize);
+
+    Buffer dyn = {};
+    for (size_t i = 0; i < b->numNeeded; ++i)
+        addDyn(&dyn, DT_NEEDED, neededOffsets[i]);
+
+    if (b->hashStyle & ELF_HASH_SYSV)
+        addDyn(&dyn, DT_HASH, hashOffset);
+
+    if (b->hashStyle & ELF_HASH_GNU)
+        addDyn(&dyn, DT_GNU_HASH, gnuHashOffset);
+
+    addDyn(&dyn, DT_SYMTAB, symtabOffset);
+    addDyn(&dyn, DT_SYMENT, sizeof(Elf32_Sym));
+    addDyn(&dyn, DT_STRTAB, strtabOffset);
+    addDyn(&dyn, DT_STRSZ, strtab.size);
+
+    if (numDynRelocs) {
+        addDyn(&dyn, b->useRela ? DT_RELA : DT_REL, dynRelocsOffset);
+        addDyn(&dyn, b->useRela ? DT_RELASZ : DT_RELSZ, numDynRelocs * relocSize);
+        addDyn(&dyn, b->useRela ? DT_RELAENT : DT_RELENT, relocSize);
+
+        if (b->relCount && numRelative)
+            addDyn(&dyn, b->useRela ? DT_RELACOUNT : DT_RELCOUNT, numRelative);
+    }
+
+    if (relr.size) {
+        addDyn(&dyn, DT_RELR, relrOffset);
+        addDyn(&dyn, DT_RELRSZ, relr.size);
+        addDyn(&dyn, DT_RELRENT, sizeof(uint32_t));
+    }
+
+    if (packedSize) {
+        addDyn(&dyn, b->useRela ? DT_ANDROID_RELA : DT_ANDROID_REL, packedOffset);
+        addDyn(&dyn, b->useRela ? DT_ANDROID_RELASZ : DT_ANDROID_RELSZ, packedSize);
+    }
+
+    if (b->hasPlt)
+        addDyn(&dyn, DT_PLTGOT, elfBuilderVAddr(b, ELF_DATA(b->pltGot)));
+
+    if (numPltRelocs) {
+        addDyn(&dyn, DT_JMPREL, pltRelocsOffset);
+        addDyn(&dyn, DT_PLTRELSZ, numPltRelocs * relocSize);
+        addDyn(&dyn, DT_PLTREL, b->useRela ? DT_RELA : DT_REL);
+    }
+
+    addDyn(&dyn, DT_NULL, 0);
+
+    bufferAlign(&file, 4);
+    const uint32_t dynOffset = bufferAppend(&file, dyn.data, dyn.size);
+    const uint32_t dataEnd = file.size;
+
+    // Past the end of the data segment, these are only reachable by file offset.
+    if (b->relocsAfterImage) {
+        dynRelocsOffset = bufferAppend(&file, NULL, numDynRelocs * relocSize);
+        pltRelocsOffset = bufferAppend(&file, NULL, numPltRelocs * relocSize);
+
+        Elf32_Dyn* d = (Elf32_Dyn*)&file.data[dynOffset];
+        for (; d->d_tag != DT_NULL; ++d) {
+            if ((d->d_tag == DT_REL) || (d->d_tag == DT_RELA))
+                d->d_un.d_ptr = dynRelocsOffset;
+            else if (d->d_tag == DT_JMPREL)
+                d->d_un.d_ptr = pltRelocsOffset;
+        }
+    }
+    free(dyn.data);
+
+    // Patch symbols.
+    for (size_t i = 1; i < b->numSyms; ++i) {
+        const ELFBuilderSym* s = &b->syms[order[i]];
+        Elf32_Sym sym = {};
+        sym.st_name = nameOffsets[order[i]];
+        sym.st_info = ELF32_ST_INFO(STB_GLOBAL, s->type);
+        if (s->defined) {
+            sym.st_value = elfBuilderVAddr(b, s->loc);
+            sym.st_size = s->size;
+            sym.st_shndx = (s->loc.segment == ELF_SEG_TEXT) ? 1 : 2;
+        } else {
+            sym.st_shndx = SHN_UNDEF;
+        }
+
+        memcpy(&file.data[symtabOffset + i * sizeof(Elf32_Sym)], &sym, sizeof(sym));
+    }
+
+    // Patch relocations, REL stores the addend in place.
+    Buffer dynRelocs = {};
+    Buffer pltRelocs = {};
+    for (size_t i = 0; i < b->numRelocs; ++i) {
+        const ELFBuilderReloc* r = &b->relocs[i];
+        const uint8_t kind = relocKind(b, r);
+        const bool leading = (kind == RELOC_DYN) && (r->type == R_ARM_RELATIVE);
+
+        // Like -z combreloc, relative relocations go first.
+        if (((kind == RELOC_DYN) || (kind == RELOC_PLT)) && (!b->relCount || leading))
+            writeReloc(b, r->plt ? &pltRelocs : &dynRelocs, r, symIndices);
+
+        if (kind == RELOC_PLT) {
+            // Until bound, slots point to PLT0.
+            const uint32_t plt0 = elfBuilderVAddr(b, ELF_TEXT(b->plt0));
+            memcpy(&file.data[b->dataVAddr + r->offset], &plt0, sizeof(plt0));
+        } else if (!b->useRela || (kind == RELOC_RELR)) {
+            const uint32_t inPlace = (r->type == R_ARM_RELATIVE) ? elfBuilderVAddr(b, r->target) : (uint32_t)r->addend;
+            memcpy(&file.data[b->dataVAddr + r->offset], &inPlace, sizeof(inPlace));
+        }
+    }
+
+    if (b->relCount) {
+        for (size_t i = 0; i < b->numRelocs; ++i) {
+            const ELFBuilderReloc* r = &b->relocs[i];
+            const uint8_t kind = relocKind(b, r);
+            if ((kind == RELOC_PLT) || ((kind == RELOC_DYN) && (r->type != R_ARM_RELATIVE)))
+                writeReloc(b, r->plt ? &pltRelocs : &dynRelocs, r, symIndices);
+        }
+    }
+
+    // Addresses in the RELR table are even entries, bitmaps are odd.
+    for (size_t i = 0; i < relr.size; i += sizeof(uint32_t)) {
+        uint32_t entry;
+        memcpy(&entry, &relr.data[i], sizeof(entry));
+        if (!(entry & 1))
+            entry += b->dataVAddr;
+
+        memcpy(&file.data[relrOffset + i], &entry, sizeof(entry));
+    }
+
+    if (packedSize) {
+        Buffer packed = {};
+        encodePacked(b, &packed, symIndices);
+        memcpy(&file.data[packedOffset], packed.data, packed.size);
+        free(packed.data);
+    }
+
+    if (b->hasPlt) {
+        const uint32_t plt0 = elfBuilderVAddr(b, ELF_TEXT(b->plt0));
+        const uint32_t gotOffset = elfBuilderVAddr(b, ELF_DATA(b->pltGot)) - (plt0 + 16);
+        memcpy(&file.data[plt0 + 16], &gotOffset, sizeof(gotOffset));
+        memcpy(&file.data[elfBuilderVAddr(b, ELF_DATA(b->pltGot))], &dynOffset, sizeof(dynOffset));
+    }
+
+    if (dynRelocs.size)
+        memcpy(&file.data[dynRelocsOffset], dynRelocs.data, dynRelocs.size);
+
+    if (pltRelocs.size)
+        memcpy(&file.data[pltRelocsOffset], pltRelocs.data, pltRelocs.size);
+
+    free(dynRelocs.data);
+    free(pltRelocs.data);
+    free(relr.data);
+
+    // Headers.
+    Elf32_Ehdr* ehdr = (Elf32_Ehdr*)file.data;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_type = ET_DYN;
+    ehdr->e_machine = EM_ARM;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_phoff = sizeof(Elf32_Ehdr);
+    ehdr->e_flags = EF_ARM_EABI_VER5;
+    ehdr->e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr->e_phentsize = sizeof(Elf32_Phdr);
+    ehdr->e_phnum = NUM_PHDRS;
+
+    Elf32_Phdr* phdrs = (Elf32_Phdr*)(file.data + sizeof(Elf32_Ehdr));
+    phdrs[0].p_type = PT_LOAD;
+    phdrs[0].p_offset = 0;
+    phdrs[0].p_vaddr = 0;
+    phdrs[0].p_paddr = 0;
+    phdrs[0].p_filesz = textEnd;
+    phdrs[0].p_memsz = textEnd;
+    phdrs[0].p_flags = PF_R | PF_X;
+    phdrs[0].p_align = b->segmentAlign ? b->segmentAlign : PAGE_SIZE;
+
+    phdrs[1].p_type = PT_LOAD;
+    phdrs[1].p_offset = b->dataVAddr;
+    phdrs[1].p_vaddr = b->dataVAddr;
+    phdrs[1].p_paddr = b->dataVAddr;
+    phdrs[1].p_filesz = dataEnd - b->dataVAddr;
+    phdrs[1].p_memsz = dataEnd - b->dataVAddr + b->bssSize;
+    phdrs[1].p_flags = PF_R | PF_W;
+    phdrs[1].p_align = b->segmentAlign ? b->segmentAlign : PAGE_SIZE;
+
+    phdrs[2].p_type = PT_DYNAMIC;
+    phdrs[2].p_offset = dynOffset;
+    phdrs[2].p_vaddr = dynOffset;
+    phdrs[2].p_paddr = dynOffset;
+    phdrs[2].p_filesz = dataEnd - dynOffset;
+    phdrs[2].p_memsz = dataEnd - dynOffset;
+    phdrs[2].p_flags = PF_R | PF_W;
+    phdrs[2].p_align = 4;
+
+    free(nameOffsets);
+    free(neededOffsets);
+    free(order);
+    free(symIndices);
+    free(hashes);
+    free(strtab.data);
+
+    *out = file.data;
+    *outSize = file.size;
+    return true;
+}
+
+bool elfBuilderWrite(ELFBuilder* b, const char* path) {
+    uint8_t* data;
+    size_t size;
+    if (!elfBuilderBuild(b, &data, &size))
+        return false;
+
+    FILE* f = fopen(path, "wb");
+    bool ret = f && (fwrite(data, 1, size, f) == size);
+    if (f)
+        ret = !fclose(f) && ret;
+
+    free(data);
+    return ret;
+}
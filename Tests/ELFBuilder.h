@@ -0,0 +1,93 @@
+#ifndef _CTRDL_TEST_ELFBUILDER_H
+#define _CTRDL_TEST_ELFBUILDER_H
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Builds ARM ET_DYN objects laid out like the ones produced by arm-none-eabi-ld,
+// a R+X segment holding headers, tables and text, followed by a R+W data segment.
+
+#define ELF_SEG_TEXT 0
+#define ELF_SEG_DATA 1
+
+#define ELF_HASH_SYSV 0x1
+#define ELF_HASH_GNU 0x2
+
+#define ELF_PACK_NONE 0
+#define ELF_PACK_RELR 1    // Relative relocations go into DT_RELR.
+#define ELF_PACK_ANDROID 2 // Non PLT relocations go into DT_ANDROID_REL(A).
+
+typedef struct {
+    uint8_t segment;
+    uint32_t offset;
+} ELFLoc;
+
+#define ELF_TEXT(off) ((ELFLoc){ ELF_SEG_TEXT, (off) })
+#define ELF_DATA(off) ((ELFLoc){ ELF_SEG_DATA, (off) })
+
+typedef struct {
+    const char* name;
+    ELFLoc loc;
+    uint32_t size;
+    uint8_t type;
+    bool defined;
+} ELFBuilderSym;
+
+typedef struct {
+    uint32_t offset; // Data offset of the patched word.
+    uint8_t type;    // Relocation type.
+    uint32_t sym;    // Symbol index.
+    ELFLoc target;   // Target for R_ARM_RELATIVE.
+    int32_t addend;  // Additional addend.
+    bool plt;        // Goes into DT_JMPREL.
+} ELFBuilderReloc;
+
+typedef struct {
+    uint8_t* text;
+    size_t textSize;
+    uint8_t* data;
+    size_t dataSize;
+    size_t bssSize;
+    ELFBuilderSym* syms;
+    size_t numSyms;
+    ELFBuilderReloc* relocs;
+    size_t numRelocs;
+    const char** needed;
+    size_t numNeeded;
+    bool useRela;
+    bool relCount;         // Sort relative relocations first and emit DT_RELCOUNT.
+    uint8_t hashStyle;     // ELF_HASH_* flags, SysV only by default.
+    uint8_t packing;       // ELF_PACK_* value, none by default.
+    bool relocsAfterImage; // Place relocation tables outside of the loaded segments.
+    uint32_t segmentAlign; // p_align of the loaded segments, page size when 0.
+    bool hasPlt;           // Set once a R_ARM_JUMP_SLOT is added.
+    uint32_t plt0;         // Text offset of PLT0.
+    uint32_t pltGot;       // Data offset of the GOT.
+    uint32_t textVAddr;    // Set by elfBuilderBuild().
+    uint32_t dataVAddr;    // Set by elfBuilderBuild().
+} ELFBuilder;
+
+void elfBuilderInit(ELFBuilder* b);
+void elfBuilderFree(ELFBuilder* b);
+
+uint32_t elfBuilderText(ELFBuilder* b, size_t size);
+uint32_t elfBuilderData(ELFBuilder* b, const void* data, size_t size);
+uint32_t elfBuilderWord(ELFBuilder* b, uint32_t value);
+void elfBuilderBss(ELFBuilder* b, size_t size);
+
+uint32_t elfBuilderExport(ELFBuilder* b, const char* name, ELFLoc loc, uint32_t size, uint8_t type);
+uint32_t elfBuilderImport(ELFBuilder* b, const char* name);
+void elfBuilderNeeded(ELFBuilder* b, const char* name);
+
+void elfBuilderRelative(ELFBuilder* b, uint32_t offset, ELFLoc target);
+void elfBuilderSymbolic(ELFBuilder* b, uint32_t offset, uint8_t type, uint32_t sym, int32_t addend);
+
+// Layout helpers, valid after elfBuilderBuild().
+uint32_t elfBuilderVAddr(const ELFBuilder* b, ELFLoc loc);
+
+bool elfBuilderBuild(ELFBuilder* b, uint8_t** out, size_t* outSize);
+bool elfBuilderWrite(ELFBuilder* b, const char* path);
+
+#endif /* _CTRDL_TEST_ELFBUILDER_H */
@@ -0,0 +1,937 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+
+#include "ELFBuilder.h"
+#include "Platform.h"
+#include "Relocs.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define EXT_VALUE_ADDR 0xCAFE0000
+#define NUM_MANY_DEPS 40
+#define NUM_THREADS 4
+#define NUM_THREAD_ITERATIONS 20000
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_Failures;                                                    \
+        }                                                                    \
+    } while (0)
+
+static int g_Failures = 0;
+static char g_Dir[] = "/tmp/ctrdl-test-XXXXXX";
+static size_t g_NumEnumerated = 0;
+
+// Layout options the loader must handle the same way.
+typedef struct {
+    uint8_t hashStyle;
+    bool useRela;
+    bool relCount;
+    uint8_t packing;
+    bool relocsAfterImage;
+} ObjectStyle;
+
+static const ObjectStyle g_Styles[] = {
+    { ELF_HASH_SYSV, false, true, ELF_PACK_NONE },
+    { ELF_HASH_GNU, false, false, ELF_PACK_NONE },
+    { ELF_HASH_SYSV | ELF_HASH_GNU, true, true, ELF_PACK_NONE },
+    { ELF_HASH_GNU, true, false, ELF_PACK_NONE },
+    { ELF_HASH_GNU, false, true, ELF_PACK_RELR },
+    { ELF_HASH_GNU, true, true, ELF_PACK_RELR },
+    { ELF_HASH_GNU, false, true, ELF_PACK_ANDROID },
+    { ELF_HASH_GNU, true, true, ELF_PACK_ANDROID },
+    { ELF_HASH_GNU, false, true, ELF_PACK_NONE, true },
+    { ELF_HASH_GNU, true, false, ELF_PACK_NONE, true },
+};
+
+static void applyStyle(ELFBuilder* b, const ObjectStyle* style) {
+    b->hashStyle = style->hashStyle;
+    b->useRela = style->useRela;
+    b->relCount = style->relCount;
+    b->packing = style->packing;
+    b->relocsAfterImage = style->relocsAfterImage;
+}
+
+static const char* makePath(const char* name) {
+    static char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s/%s", g_Dir, name);
+    return buffer;
+}
+
+static void* resolver(const char* sym, void* unused) {
+    if (!strcmp(sym, "extValue"))
+        return (void*)EXT_VALUE_ADDR;
+
+    return NULL;
+}
+
+static void batchResolver(const char* const* syms, void** addrs, size_t count, void* userData) {
+    size_t* numCalls = userData;
+    ++numCalls[0];
+    numCalls[1] += count;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!strcmp(syms[i], "extValue"))
+            addrs[i] = (void*)EXT_VALUE_ADDR;
+    }
+}
+
+static void enumerateCallback(void* handle) { ++g_NumEnumerated; }
+
+static size_t countHandles(void) {
+    g_NumEnumerated = 0;
+    ctrdlEnumerate(enumerateCallback);
+    return g_NumEnumerated;
+}
+
+static bool writeDep(const ObjectStyle* style) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+    applyStyle(&b, style);
+
+    const uint32_t value = elfBuilderWord(&b, 1234);
+    elfBuilderExport(&b, "depValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const uint32_t func = elfBuilderText(&b, 16);
+    elfBuilderExport(&b, "depFunc", ELF_TEXT(func), 16, STT_FUNC);
+
+    const bool ret = elfBuilderWrite(&b, makePath("Dep.so"));
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static bool writeMain(const ObjectStyle* style) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+    applyStyle(&b, style);
+    elfBuilderNeeded(&b, "Dep.so");
+
+    const uint32_t value = elfBuilderWord(&b, 42);
+    elfBuilderExport(&b, "mainValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const uint32_t func = elfBuilderText(&b, 32);
+    elfBuilderExport(&b, "mainFunc", ELF_TEXT(func), 32, STT_FUNC);
+
+    // Pointers to local data.
+    const uint32_t valuePtr = elfBuilderWord(&b, 0);
+    elfBuilderRelative(&b, valuePtr, ELF_DATA(value));
+    elfBuilderExport(&b, "mainValuePtr", ELF_DATA(valuePtr), 4, STT_OBJECT);
+
+    const uint32_t funcPtr = elfBuilderWord(&b, 0);
+    elfBuilderRelative(&b, funcPtr, ELF_TEXT(func));
+    elfBuilderExport(&b, "mainFuncPtr", ELF_DATA(funcPtr), 4, STT_OBJECT);
+
+    // Imports.
+    const uint32_t depValue = elfBuilderImport(&b, "depValue");
+    const uint32_t depValueGot = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, depValueGot, R_ARM_GLOB_DAT, depValue, 0);
+    elfBuilderExport(&b, "depValueGot", ELF_DATA(depValueGot), 4, STT_OBJECT);
+
+    // Resolved once, see the cache checks.
+    const uint32_t depValueGot2 = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, depValueGot2, R_ARM_GLOB_DAT, depValue, 0);
+    elfBuilderExport(&b, "depValueGot2", ELF_DATA(depValueGot2), 4, STT_OBJECT);
+
+    const uint32_t depFunc = elfBuilderImport(&b, "depFunc");
+    const uint32_t depFuncSlot = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, depFuncSlot, R_ARM_JUMP_SLOT, depFunc, 0);
+    elfBuilderExport(&b, "depFuncSlot", ELF_DATA(depFuncSlot), 4, STT_OBJECT);
+
+    const uint32_t extValue = elfBuilderImport(&b, "extValue");
+    const uint32_t extValueAbs = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, extValueAbs, R_ARM_ABS32, extValue, 8);
+    elfBuilderExport(&b, "extValueAbs", ELF_DATA(extValueAbs), 4, STT_OBJECT);
+
+    const bool ret = elfBuilderWrite(&b, makePath("Main.so"));
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static bool writeShared(const char* name, uint32_t value) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+
+    const uint32_t shared = elfBuilderWord(&b, value);
+    elfBuilderExport(&b, "sharedValue", ELF_DATA(shared), 4, STT_OBJECT);
+
+    const bool ret = elfBuilderWrite(&b, makePath(name));
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static bool writeUser(void) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+
+    // No DT_NEEDED, the import can only come from global objects.
+    const uint32_t shared = elfBuilderImport(&b, "sharedValue");
+    const uint32_t sharedGot = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, sharedGot, R_ARM_GLOB_DAT, shared, 0);
+    elfBuilderExport(&b, "sharedValueGot", ELF_DATA(sharedGot), 4, STT_OBJECT);
+
+    const bool ret = elfBuilderWrite(&b, makePath("User.so"));
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static bool writeMany(void) {
+    // Names must outlive the builder.
+    static char names[NUM_MANY_DEPS][32];
+    for (size_t i = 0; i < NUM_MANY_DEPS; ++i) {
+        snprintf(names[i], sizeof(names[i]), "Many%02zu.so", i);
+        if (!writeShared(names[i], i))
+            return false;
+    }
+
+    ELFBuilder b;
+    elfBuilderInit(&b);
+
+    for (size_t i = 0; i < NUM_MANY_DEPS; ++i)
+        elfBuilderNeeded(&b, names[i]);
+
+    const uint32_t value = elfBuilderWord(&b, 0);
+    elfBuilderExport(&b, "manyValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const bool ret = elfBuilderWrite(&b, makePath("Many.so"));
+    elfBuilderFree(&b);
+    return ret;
+}
+
+static void testLoad(void) {
+    void* h = ctrdlOpen(makePath("Main.so"), RTLD_NOW, resolver, NULL);
+    CHECK(h);
+    if (!h) {
+        printf("ctrdlOpen() failed: %s\n", dlerror());
+        return;
+    }
+
+    CHECK(countHandles() == 2);
+
+    u32* mainValue = dlsym(h, "mainValue");
+    CHECK(mainValue && (*mainValue == 42));
+
+    u32* mainValuePtr = dlsym(h, "mainValuePtr");
+    CHECK(mainValuePtr && (*mainValuePtr == (u32)(uintptr_t)mainValue));
+
+    u32* mainFuncPtr = dlsym(h, "mainFuncPtr");
+    CHECK(mainFuncPtr && (*mainFuncPtr == (u32)(uintptr_t)dlsym(h, "mainFunc")));
+
+    // Symbols from dependencies.
+    u32* depValue = dlsym(h, "depValue");
+    CHECK(depValue && (*depValue == 1234));
+
+    u32* depValueGot = dlsym(h, "depValueGot");
+    CHECK(depValueGot && (*depValueGot == (u32)(uintptr_t)depValue));
+
+    u32* depValueGot2 = dlsym(h, "depValueGot2");
+    CHECK(depValueGot2 && (*depValueGot2 == (u32)(uintptr_t)depValue));
+
+    u32* depFuncSlot = dlsym(h, "depFuncSlot");
+    CHECK(depFuncSlot && (*depFuncSlot == (u32)(uintptr_t)dlsym(h, "depFunc")));
+
+    // Symbols from the resolver.
+    u32* extValueAbs = dlsym(h, "extValueAbs");
+    CHECK(extValueAbs && (*extValueAbs == (EXT_VALUE_ADDR + 8)));
+
+    CHECK(!dlsym(h, "missing"));
+    CHECK(!dlsym(h, "extValue"));
+
+    // Prehashed and batch lookups.
+    CHECK(CTRDL_SYM_HASH("depValueGot") == ctrdl_getELFGNUSymNameHash("depValueGot"));
+    CHECK(CTRDL_SYM_HASH("a_name_which_is_too_long_to_be_hashed_by_the_macro_at_compile_time_") == 0);
+    CHECK(ctrdlSymHashed(h, "depValueGot", CTRDL_SYM_HASH("depValueGot")) == depValueGot);
+    CHECK(ctrdlSymHashed(h, "depValue", 0) == depValue);
+
+    const char* batchNames[] = { "mainValue", "missing", "depValue", NULL };
+    void* batchOut[4];
+    CHECK(ctrdlSymBatch(h, batchNames, 4, batchOut) == 2);
+    CHECK((batchOut[0] == mainValue) && !batchOut[1] && (batchOut[2] == depValue) && !batchOut[3]);
+
+    // Repeated lookups hit the cache, a different name at the same address doesn't.
+    CTRDLSymCacheStats before, after;
+    ctrdlSymCacheStats(&before);
+    static const char cachedName[] = "depValueGot";
+    CHECK(dlsym(h, cachedName) == depValueGot);
+    CHECK(dlsym(h, cachedName) == depValueGot);
+    char nameBuffer[16];
+    strcpy(nameBuffer, "depFuncSlot");
+    CHECK(dlsym(h, nameBuffer) == depFuncSlot);
+    strcpy(nameBuffer, "mainValue");
+    CHECK(dlsym(h, nameBuffer) == mainValue);
+    ctrdlSymCacheStats(&after);
+    CHECK((after.hits - before.hits) == 1);
+    CHECK((after.misses - before.misses) == 3);
+
+    // Address lookup.
+    Dl_info info = {};
+    CHECK(dladdr(mainValue, &info));
+    CHECK(info.dli_fname && !strcmp(info.dli_fname, makePath("Main.so")));
+
+    CTRDLInfo ctrdlInfoData;
+    CHECK(ctrdlInfo(h, &ctrdlInfoData));
+    CHECK(info.dli_fbase == (void*)(uintptr_t)ctrdlInfoData.base);
+
+    // Header, dynamic and segments, each in a single pass, plus streamed relocations.
+    CHECK(ctrdlInfoData.bytesRead > 0);
+    CHECK(ctrdlInfoData.numSeeks <= 4);
+
+    // Each import is resolved once.
+    CHECK(ctrdlInfoData.symCacheMisses == 3);
+    CHECK(ctrdlInfoData.symCacheHits == 1);
+
+    // Symbol names are read from the mapped image.
+    const u32 sname = (u32)(uintptr_t)info.dli_sname;
+    CHECK(info.dli_sname && !strcmp(info.dli_sname, "mainValue"));
+    CHECK((sname >= ctrdlInfoData.base) && (sname < (ctrdlInfoData.base + ctrdlInfoData.size)));
+    CHECK(ctrdlHandleByAddress((u32)(uintptr_t)mainValue) == h);
+    CHECK(!dlclose(h));
+    CHECK(ctrdlHandleByAddress(ctrdlInfoData.base + ctrdlInfoData.size - 1) == h);
+    CHECK(!ctrdlHandleByAddress(ctrdlInfoData.base + ctrdlInfoData.size));
+
+    // Inside a symbol, and past its end with no symbol following it.
+    u8* mainFunc = dlsym(h, "mainFunc");
+    CHECK(mainFunc && dladdr(mainFunc + 20, &info));
+    CHECK(info.dli_sname && !strcmp(info.dli_sname, "mainFunc") && (info.dli_saddr == mainFunc));
+    CHECK(dladdr(mainFunc + 32, &info));
+    CHECK(info.dli_sname && !strcmp(info.dli_sname, "mainFunc"));
+
+    // Batch lookups keep the input order.
+    const u32 batchAddrs[] = { (u32)(uintptr_t)(mainFunc + 20), 0x10, (u32)(uintptr_t)mainValue, (u32)(uintptr_t)mainFunc };
+    Dl_info batchInfo[4];
+    CHECK(ctrdlSymbolizeBatch(batchAddrs, 4, batchInfo) == 3);
+    CHECK(batchInfo[0].dli_sname && !strcmp(batchInfo[0].dli_sname, "mainFunc"));
+    CHECK(!batchInfo[1].dli_fbase && !batchInfo[1].dli_sname);
+    CHECK(batchInfo[2].dli_sname && !strcmp(batchInfo[2].dli_sname, "mainValue"));
+    CHECK(batchInfo[3].dli_saddr == mainFunc);
+    CHECK(batchInfo[3].dli_fbase == info.dli_fbase);
+    CHECK(!dlclose(h));
+    ctrdlFreeInfo(&ctrdlInfoData);
+
+    // Placed right after its dependency.
+    void* dep = ctrdlOpen(makePath("Dep.so"), RTLD_NOW | RTLD_NOLOAD, NULL, NULL);
+    CTRDLInfo depInfo;
+    CHECK(dep && ctrdlInfo(dep, &depInfo));
+    CHECK((depInfo.base + depInfo.size) == ctrdlInfoData.base);
+    ctrdlFreeInfo(&depInfo);
+    CHECK(!dlclose(dep));
+
+    // Already open.
+    void* h2 = ctrdlOpen(makePath("Main.so"), RTLD_NOW | RTLD_NOLOAD, resolver, NULL);
+    CHECK(h2 == h);
+    CHECK(!dlclose(h2));
+
+    // Equivalent paths match, substrings don't.
+    h2 = ctrdlOpen(makePath(".//./Main.so"), RTLD_NOW | RTLD_NOLOAD, resolver, NULL);
+    CHECK(h2 == h);
+    CHECK(!dlclose(h2));
+    CHECK(!ctrdlOpen("ain.so", RTLD_NOW | RTLD_NOLOAD, resolver, NULL));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+static u32 loadUserGot(void) {
+    void* h = ctrdlOpen(makePath("User.so"), RTLD_NOW, NULL, NULL);
+    if (!h)
+        return 0;
+
+    u32* got = dlsym(h, "sharedValueGot");
+    const u32 value = got ? *got : 0;
+    CHECK(!dlclose(h));
+    return value;
+}
+
+static void testGlobal(void) {
+    CHECK(!loadUserGot());
+
+    // Local objects are not part of the global scope.
+    void* a = ctrdlOpen(makePath("SharedA.so"), RTLD_NOW, NULL, NULL);
+    CHECK(a);
+    CHECK(!loadUserGot());
+
+    // Promoted on reopen.
+    CHECK(ctrdlOpen(makePath("SharedA.so"), RTLD_NOW | RTLD_GLOBAL, NULL, NULL) == a);
+    CHECK(!dlclose(a));
+
+    void* b = ctrdlOpen(makePath("SharedB.so"), RTLD_NOW | RTLD_GLOBAL, NULL, NULL);
+    CHECK(b);
+
+    // The first definition wins.
+    CHECK(loadUserGot() == (u32)(uintptr_t)dlsym(a, "sharedValue"));
+
+    // And once unloaded, the next one takes over.
+    CHECK(!dlclose(a));
+    CHECK(loadUserGot() == (u32)(uintptr_t)dlsym(b, "sharedValue"));
+
+    CHECK(!dlclose(b));
+    CHECK(!loadUserGot());
+    CHECK(countHandles() == 0);
+}
+
+static void testLazy(const ObjectStyle* style) {
+    void* h = ctrdlOpen(makePath("Main.so"), RTLD_LAZY, resolver, NULL);
+    CHECK(h);
+    if (!h) {
+        printf("ctrdlOpen() failed: %s\n", dlerror());
+        return;
+    }
+
+    // Only PLT slots are deferred.
+    u32* depValueGot = dlsym(h, "depValueGot");
+    CHECK(depValueGot && (*depValueGot == (u32)(uintptr_t)dlsym(h, "depValue")));
+
+    const u32 depFunc = (u32)(uintptr_t)dlsym(h, "depFunc");
+    u32* depFuncSlot = dlsym(h, "depFuncSlot");
+    CTRDLInfo info;
+
+    // Streamed PLT relocations are bound at load.
+    if (style->relocsAfterImage) {
+        CHECK(depFuncSlot && (*depFuncSlot == depFunc));
+        CHECK(ctrdlInfo(h, &info));
+        CHECK(info.numLazySlots == 0);
+        ctrdlFreeInfo(&info);
+        CHECK(!dlclose(h));
+        return;
+    }
+
+    CHECK(depFuncSlot && (*depFuncSlot != depFunc));
+
+    CHECK(ctrdlInfo(h, &info));
+    CHECK(info.numLazySlots == 1);
+    CHECK(info.numBoundSlots == 0);
+    ctrdlFreeInfo(&info);
+
+    // What the trampoline does on first call.
+    if (depFuncSlot) {
+        CHECK(ctrdl_bindLazySlot(h, (u32)(uintptr_t)depFuncSlot) == depFunc);
+        CHECK(*depFuncSlot == depFunc);
+        CHECK(ctrdl_bindLazySlot(h, (u32)(uintptr_t)depFuncSlot) == depFunc);
+    }
+
+    CHECK(ctrdlInfo(h, &info));
+    CHECK(info.numBoundSlots == 1);
+    ctrdlFreeInfo(&info);
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+static void testMany(void) {
+    // More objects and dependencies than a single handle slab.
+    void* h = ctrdlOpen(makePath("Many.so"), RTLD_NOW, NULL, NULL);
+    CHECK(h);
+    if (!h)
+        return;
+
+    CHECK(countHandles() == (NUM_MANY_DEPS + 1));
+
+    // Dependencies are searched in DT_NEEDED order.
+    u32* sharedValue = dlsym(h, "sharedValue");
+    CHECK(sharedValue && (*sharedValue == 0));
+
+    // Every object can be found by address.
+    char name[32];
+    snprintf(name, sizeof(name), "Many%02d.so", NUM_MANY_DEPS - 1);
+    void* last = ctrdlOpen(makePath(name), RTLD_NOW | RTLD_NOLOAD, NULL, NULL);
+    CHECK(last);
+    sharedValue = dlsym(last, "sharedValue");
+    CHECK(sharedValue && (*sharedValue == (NUM_MANY_DEPS - 1)));
+    CHECK(ctrdlHandleByAddress((u32)(uintptr_t)sharedValue) == last);
+    CHECK(!dlclose(last));
+    CHECK(!dlclose(last));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+
+    // Unmapped ranges are merged back together.
+    CTRDLSpaceStats stats;
+    CHECK(ctrdlSpaceStats(&stats));
+    CHECK((stats.numFreeRanges == 1) && (stats.freeSize == stats.totalSize) && (stats.largestFree == stats.totalSize));
+    CHECK(!stats.numStale && !stats.numFallbacks);
+}
+
+static void* lookupThread(void* handle) {
+    size_t failures = 0;
+    u32* value = dlsym(handle, "sharedValueGot");
+
+    for (size_t i = 0; i < NUM_THREAD_ITERATIONS; ++i) {
+        if (dlsym(handle, "sharedValueGot") != value)
+            ++failures;
+
+        void* h = ctrdlHandleByAddress((u32)(uintptr_t)value);
+        if (h != handle)
+            ++failures;
+
+        if (h)
+            dlclose(h);
+    }
+
+    return (void*)failures;
+}
+
+static void testThreads(void) {
+    void* shared = dlopen(makePath("SharedA.so"), RTLD_NOW | RTLD_GLOBAL);
+    void* h = dlopen(makePath("User.so"), RTLD_NOW);
+    CHECK(shared && h);
+    if (!shared || !h)
+        return;
+
+    // Lookups race with other objects being loaded and unloaded.
+    pthread_t threads[NUM_THREADS];
+    for (size_t i = 0; i < NUM_THREADS; ++i)
+        CHECK(!pthread_create(&threads[i], NULL, lookupThread, h));
+
+    for (size_t i = 0; i < 100; ++i) {
+        void* other = dlopen(makePath("SharedB.so"), RTLD_NOW);
+        CHECK(other);
+        if (other)
+            CHECK(!dlclose(other));
+    }
+
+    for (size_t i = 0; i < NUM_THREADS; ++i) {
+        void* failures = NULL;
+        CHECK(!pthread_join(threads[i], &failures));
+        CHECK(!failures);
+    }
+
+    CHECK(!dlclose(h));
+    CHECK(!dlclose(shared));
+    CHECK(countHandles() == 0);
+}
+
+static void* openShared(void* unused) {
+    void* h = ctrdlOpen(makePath("SharedA.so"), RTLD_NOW, NULL, NULL);
+    if (h)
+        dlclose(h);
+
+    return h;
+}
+
+static void* waitingResolver(const char* sym, void* unused) {
+    // Would deadlock if the loader held the handle mutex.
+    pthread_t thread;
+    void* opened = NULL;
+    if (!pthread_create(&thread, NULL, openShared, NULL))
+        pthread_join(thread, &opened);
+
+    CHECK(opened);
+    return resolver(sym, unused);
+}
+
+static void testWaitingResolver(void) {
+    void* h = ctrdlOpen(makePath("Main.so"), RTLD_NOW, waitingResolver, NULL);
+    CHECK(h);
+    if (!h)
+        return;
+
+    u32* extValueAbs = dlsym(h, "extValueAbs");
+    CHECK(extValueAbs && (*extValueAbs == (EXT_VALUE_ADDR + 8)));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+static void* g_ClosingHandle = NULL;
+
+static void closingCallback(void* handle) {
+    ++g_NumEnumerated;
+    if (handle == g_ClosingHandle)
+        CHECK(!dlclose(handle));
+}
+
+static void testEnumerateClose(void) {
+    // Closing Main.so unloads Dep.so, which comes after it.
+    g_ClosingHandle = ctrdlOpen(makePath("Main.so"), RTLD_NOW, resolver, NULL);
+    CHECK(g_ClosingHandle);
+    if (!g_ClosingHandle)
+        return;
+
+    g_NumEnumerated = 0;
+    ctrdlEnumerate(closingCallback);
+    CHECK(g_NumEnumerated == 2);
+    CHECK(countHandles() == 0);
+}
+
+static void testBatchResolver(void) {
+    // Called once for Main.so with its three imports, Dep.so has none.
+    size_t numCalls[2] = {};
+    void* h = ctrdlOpenBatch(makePath("Main.so"), RTLD_NOW, batchResolver, numCalls);
+    CHECK(h);
+    if (!h)
+        return;
+
+    CHECK((numCalls[0] == 1) && (numCalls[1] == 3));
+
+    u32* extValueAbs = dlsym(h, "extValueAbs");
+    CHECK(extValueAbs && (*extValueAbs == (EXT_VALUE_ADDR + 8)));
+
+    // Imports left unresolved come from dependencies.
+    u32* depValueGot = dlsym(h, "depValueGot");
+    CHECK(depValueGot && (*depValueGot == (u32)(uintptr_t)dlsym(h, "depValue")));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+// Set while Probe.so is relocated, from its resolver.
+static uint32_t g_ProbeValueVAddr = 0;
+static void* g_ProbeHandle = NULL;
+static bool g_ProbeChecked = false;
+
+static void findProbe(void* handle) {
+    CTRDLInfo info;
+    if (ctrdlInfo(handle, &info)) {
+        if (strstr(info.path, "Probe.so"))
+            g_ProbeHandle = handle;
+
+        ctrdlFreeInfo(&info);
+    }
+}
+
+static void* probeResolver(const char* sym, void* unused) {
+    g_ProbeHandle = NULL;
+    ctrdlEnumerate(findProbe);
+    CHECK(g_ProbeHandle);
+
+    CTRDLInfo info;
+    if (g_ProbeHandle && ctrdlInfo(g_ProbeHandle, &info)) {
+        // The object is mapped, but its symbols can't be looked up yet.
+        Dl_info dlInfo;
+        CHECK(dladdr((void*)(uintptr_t)(info.base + g_ProbeValueVAddr), &dlInfo));
+        CHECK(!dlInfo.dli_sname);
+        CHECK(!dlsym(g_ProbeHandle, "probeValue"));
+        g_ProbeChecked = true;
+        ctrdlFreeInfo(&info);
+    }
+
+    return (void*)EXT_VALUE_ADDR;
+}
+
+static void testEarlyLookup(void) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+
+    const uint32_t value = elfBuilderWord(&b, 3);
+    elfBuilderExport(&b, "probeValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const uint32_t extValue = elfBuilderImport(&b, "extValue");
+    const uint32_t extValueAbs = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, extValueAbs, R_ARM_ABS32, extValue, 0);
+
+    const bool written = elfBuilderWrite(&b, makePath("Probe.so"));
+    g_ProbeValueVAddr = elfBuilderVAddr(&b, ELF_DATA(value));
+    elfBuilderFree(&b);
+    CHECK(written);
+    if (!written)
+        return;
+
+    void* h = ctrdlOpen(makePath("Probe.so"), RTLD_NOW, probeResolver, NULL);
+    CHECK(h && g_ProbeChecked);
+    if (!h)
+        return;
+
+    // Lookups made while loading didn't stick.
+    u32* probeValue = dlsym(h, "probeValue");
+    CHECK(probeValue && (*probeValue == 3));
+
+    Dl_info info;
+    CHECK(dladdr(probeValue, &info));
+    CHECK(info.dli_sname && !strcmp(info.dli_sname, "probeValue"));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+static void testSizing(void) {
+    // Linked for 64 KiB pages, one page of text and one of data with its BSS.
+    ELFBuilder b;
+    elfBuilderInit(&b);
+    b.segmentAlign = 0x10000;
+
+    const uint32_t value = elfBuilderWord(&b, 7);
+    elfBuilderExport(&b, "alignedValue", ELF_DATA(value), 4, STT_OBJECT);
+    elfBuilderBss(&b, 0x100);
+
+    const bool written = elfBuilderWrite(&b, makePath("Aligned.so"));
+    elfBuilderFree(&b);
+    CHECK(written);
+    if (!written)
+        return;
+
+    void* h = ctrdlOpen(makePath("Aligned.so"), RTLD_NOW, NULL, NULL);
+    CHECK(h);
+    if (!h)
+        return;
+
+    CTRDLInfo info;
+    CHECK(ctrdlInfo(h, &info));
+    CHECK(info.size == 0x2000);
+    CHECK(info.savedSize == (0x20000 - 0x2000));
+    ctrdlFreeInfo(&info);
+
+    u32* alignedValue = dlsym(h, "alignedValue");
+    CHECK(alignedValue && (*alignedValue == 7));
+
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+}
+
+static void testScatter(void) {
+    // No block can hold a whole image, each one is backed page by page.
+    ctrdl_setMaxBacking(0x1000);
+    void* h = ctrdlOpen(makePath("Main.so"), RTLD_NOW, resolver, NULL);
+    ctrdl_setMaxBacking(0);
+    CHECK(h);
+    if (!h)
+        return;
+
+    CTRDLInfo info;
+    CHECK(ctrdlInfo(h, &info));
+    CHECK(info.numPieces == (info.size / 0x1000));
+    ctrdlFreeInfo(&info);
+
+    u32* mainValuePtr = dlsym(h, "mainValuePtr");
+    CHECK(mainValuePtr && (*mainValuePtr == (u32)(uintptr_t)dlsym(h, "mainValue")));
+
+    u32* depValueGot = dlsym(h, "depValueGot");
+    CHECK(depValueGot && (*(u32*)(uintptr_t)*depValueGot == 1234));
+
+    u32* extValueAbs = dlsym(h, "extValueAbs");
+    CHECK(extValueAbs && (*extValueAbs == (EXT_VALUE_ADDR + 8)));
+
+    CHECK(ctrdlHandleByAddress((u32)(uintptr_t)mainValuePtr) == h);
+    CHECK(!dlclose(h));
+    CHECK(!dlclose(h));
+    CHECK(countHandles() == 0);
+
+    CTRDLSpaceStats stats;
+    CHECK(ctrdlSpaceStats(&stats));
+    CHECK((stats.numFreeRanges == 1) && (stats.freeSize == stats.totalSize));
+}
+
+static void testMap(void) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+    b.relocsAfterImage = true;
+
+    const uint32_t value = elfBuilderWord(&b, 9);
+    elfBuilderExport(&b, "mappedValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const uint32_t valuePtr = elfBuilderWord(&b, 0);
+    elfBuilderRelative(&b, valuePtr, ELF_DATA(value));
+    elfBuilderExport(&b, "mappedValuePtr", ELF_DATA(valuePtr), 4, STT_OBJECT);
+
+    uint8_t* file;
+    size_t fileSize;
+    const bool built = elfBuilderBuild(&b, &file, &fileSize);
+    elfBuilderFree(&b);
+    CHECK(built);
+    if (!built)
+        return;
+
+    // Aligned buffers are referenced directly, misaligned ones are read through.
+    u8* buffer = malloc(fileSize + 1);
+    CHECK(buffer);
+    for (size_t misalign = 0; buffer && (misalign < 2); ++misalign) {
+        memcpy(buffer + misalign, file, fileSize);
+
+        void* h = ctrdlMap(buffer + misalign, fileSize, RTLD_NOW, NULL, NULL);
+        CHECK(h);
+        if (!h)
+            continue;
+
+        u32* mappedValuePtr = dlsym(h, "mappedValuePtr");
+        CHECK(mappedValuePtr && (*mappedValuePtr == (u32)(uintptr_t)dlsym(h, "mappedValue")));
+
+        // Headers and tables are copied only when they can't be referenced.
+        CTRDLInfo info;
+        CHECK(ctrdlInfo(h, &info));
+        CHECK(misalign ? (info.numReads > 3) : (info.numReads == 3));
+        ctrdlFreeInfo(&info);
+
+        CHECK(!dlclose(h));
+    }
+
+    // A dynamic segment too small for a single entry.
+    Elf32_Phdr* phdrs = (Elf32_Phdr*)(file + ((Elf32_Ehdr*)file)->e_phoff);
+    for (size_t i = 0; i < ((Elf32_Ehdr*)file)->e_phnum; ++i) {
+        if (phdrs[i].p_type == PT_DYNAMIC)
+            phdrs[i].p_filesz = 4;
+    }
+
+    CHECK(!ctrdlMap(file, fileSize, RTLD_NOW, NULL, NULL));
+
+    free(buffer);
+    free(file);
+    CHECK(countHandles() == 0);
+}
+
+static void testInPlace(void) {
+    ELFBuilder b;
+    elfBuilderInit(&b);
+    b.relocsAfterImage = true;
+
+    const uint32_t value = elfBuilderWord(&b, 5);
+    elfBuilderExport(&b, "placedValue", ELF_DATA(value), 4, STT_OBJECT);
+
+    const uint32_t valuePtr = elfBuilderWord(&b, 0);
+    elfBuilderRelative(&b, valuePtr, ELF_DATA(value));
+    elfBuilderExport(&b, "placedValuePtr", ELF_DATA(valuePtr), 4, STT_OBJECT);
+
+    const uint32_t extValue = elfBuilderImport(&b, "extValue");
+    const uint32_t extValueAbs = elfBuilderWord(&b, 0);
+    elfBuilderSymbolic(&b, extValueAbs, R_ARM_ABS32, extValue, 0);
+    elfBuilderExport(&b, "placedExtValue", ELF_DATA(extValueAbs), 4, STT_OBJECT);
+
+    // The BSS overlaps the relocation tables in the file.
+    elfBuilderBss(&b, 0x100);
+
+    uint8_t* file;
+    size_t fileSize;
+    const bool built = elfBuilderBuild(&b, &file, &fileSize);
+    const uint32_t valuePtrVAddr = elfBuilderVAddr(&b, ELF_DATA(valuePtr));
+    elfBuilderFree(&b);
+    CHECK(built);
+    if (!built)
+        return;
+
+    // Shared, so that the host backend can mirror it.
+    const size_t bufferSize = ((fileSize + 0xFFF) & ~0xFFF) + 0x1000;
+    u8* buffer = mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    CHECK(buffer != MAP_FAILED);
+    if (buffer == MAP_FAILED) {
+        free(file);
+        return;
+    }
+
+    memcpy(buffer, file, fileSize);
+
+    // Private pages can't be mirrored on the host.
+    u8* privateBuffer = mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    CHECK(privateBuffer != MAP_FAILED);
+    if (privateBuffer != MAP_FAILED) {
+        memcpy(privateBuffer, file, fileSize);
+        CHECK(!ctrdlMapInPlace(privateBuffer, bufferSize, RTLD_NOW, resolver, NULL));
+        const char* error = dlerror();
+        CHECK(error && strstr(error, "shared mapping"));
+        munmap(privateBuffer, bufferSize);
+    }
+
+    free(file);
+
+    CHECK(!ctrdlMapInPlace(buffer + 4, bufferSize - 4, RTLD_NOW, resolver, NULL));
+
+    void* h = ctrdlMapInPlace(buffer, bufferSize, RTLD_NOW, resolver, NULL);
+    CHECK(h);
+    if (h) {
+        u32* placedValuePtr = dlsym(h, "placedValuePtr");
+        CHECK(placedValuePtr && (*placedValuePtr == (u32)(uintptr_t)dlsym(h, "placedValue")));
+
+        u32* placedExtValue = dlsym(h, "placedExtValue");
+        CHECK(placedExtValue && (*placedExtValue == EXT_VALUE_ADDR));
+
+        // Relocated in the caller buffer, segments were never read from the stream.
+        CHECK(*(u32*)(buffer + valuePtrVAddr) == *placedValuePtr);
+
+        CTRDLInfo info;
+        CHECK(ctrdlInfo(h, &info));
+        CHECK(info.bytesRead < fileSize);
+        ctrdlFreeInfo(&info);
+
+        CHECK(!dlclose(h));
+    }
+
+    CHECK(countHandles() == 0);
+    munmap(buffer, bufferSize);
+}
+
+static void testInvalid(void) {
+    FILE* f = fopen(makePath("Invalid.so"), "wb");
+    CHECK(f);
+    if (!f)
+        return;
+
+    fputs("not an elf", f);
+    fclose(f);
+
+    CHECK(!ctrdlOpen(makePath("Invalid.so"), RTLD_NOW, NULL, NULL));
+    CHECK(dlerror() != NULL);
+    CHECK(!ctrdlOpen(makePath("Missing.so"), RTLD_NOW, NULL, NULL));
+    CHECK(!ctrdlOpen(makePath("Main.so"), 0, NULL, NULL));
+    CHECK(countHandles() == 0);
+}
+
+int main(int argc, char* argv[]) {
+    if (!mkdtemp(g_Dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for (size_t i = 0; i < (sizeof(g_Styles) / sizeof(g_Styles[0])); ++i) {
+        if (!writeDep(&g_Styles[i]) || !writeMain(&g_Styles[i])) {
+            printf("Could not write test objects\n");
+            return 1;
+        }
+
+        testLoad();
+        testLazy(&g_Styles[i]);
+        testBatchResolver();
+        testEnumerateClose();
+        testScatter();
+    }
+
+    if (!writeShared("SharedA.so", 1) || !writeShared("SharedB.so", 2) || !writeUser()) {
+        printf("Could not write test objects\n");
+        return 1;
+    }
+
+    testGlobal();
+    testWaitingResolver();
+
+    if (!writeMany()) {
+        printf("Could not write test objects\n");
+        return 1;
+    }
+
+    testMany();
+    testThreads();
+    testEarlyLookup();
+    testSizing();
+    testMap();
+    testInPlace();
+    testInvalid();
+
+    unlink(makePath("Dep.so"));
+    unlink(makePath("Main.so"));
+    unlink(makePath("SharedA.so"));
+    unlink(makePath("SharedB.so"));
+    unlink(makePath("User.so"));
+    unlink(makePath("Invalid.so"));
+    unlink(makePath("Many.so"));
+    unlink(makePath("Aligned.so"));
+    unlink(makePath("Probe.so"));
+
+    char name[32];
+    for (size_t i = 0; i < NUM_MANY_DEPS; ++i) {
+        snprintf(name, sizeof(name), "Many%02zu.so", i);
+        unlink(makePath(name));
+    }
+
+    rmdir(g_Dir);
+
+    if (g_Failures) {
+        printf("%d check(s) failed\n", g_Failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}